@@ -30,10 +30,21 @@
 #include "lossdata.h"
 #include "reorderdata.h"
 
+struct hashMapItem;
+
 struct aggregatorData {
     struct packetData received;
     struct lossDataA loss;
     struct reorderDataA reorder;
+
+    /* Persistent entry of the stream, and the period in which this
+     * data was aggregated */
+    struct hashMapItem *stream;
+    unsigned int epoch;
+
+    /* The stream's item in the next period in which it was seen,
+     * linked by the reporter while it holds both periods */
+    struct hashMapItem *next_period;
 };
 
 #endif /* _PD3_ESTIMATOR_AGGREGATOR_DATA_H_ */
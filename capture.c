@@ -0,0 +1,117 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "capture.h"
+
+struct captureFile {
+    int fd;
+    int failed;
+    pthread_mutex_t mutex;
+};
+
+/* Writes all of `buf`, across partial writes */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+struct captureFile *capture_create(const char *path)
+{
+    pd3_estimator_capture_header header = {
+        .magic = PD3_ESTIMATOR_CAPTURE_MAGIC,
+        .version = PD3_ESTIMATOR_CAPTURE_VERSION,
+        .key_size = PD3_ESTIMATOR_KEY_SIZE,
+        .record_size = sizeof(pd3_estimator_capture_record),
+    };
+    struct captureFile *c;
+
+    c = calloc(1, sizeof(*c));
+    if (!c) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+    c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (c->fd == -1) {
+        perror("open");
+        free(c);
+        return NULL;
+    }
+    if (write_all(c->fd, &header, sizeof(header)) == -1) {
+        perror("write");
+        close(c->fd);
+        unlink(path);
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->mutex, NULL);
+    return c;
+}
+
+void capture_destroy(struct captureFile *c)
+{
+    if (!c) {
+        return;
+    }
+    close(c->fd);
+    pthread_mutex_destroy(&c->mutex);
+    free(c);
+}
+
+int capture_write(struct captureFile *c, const pd3_estimator_capture_record *records,
+                  unsigned int n)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&c->mutex);
+    if (!c->failed) {
+        ret = write_all(c->fd, records, n * sizeof(*records));
+        if (ret == -1) {
+            perror("capture write");
+            c->failed = 1;
+        }
+    }
+    pthread_mutex_unlock(&c->mutex);
+    return ret;
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_CAPTURE_H_
+#define _PD3_ESTIMATOR_CAPTURE_H_
+
+#include "pd3_estimator.h"
+
+/* Number of records a handle gathers before appending them to the
+ * capture file */
+#define CAPTURE_BUFFER_RECORDS 4096
+
+/* Capture file shared by all handles, see
+ * pd3_estimator_capture_header */
+struct captureFile;
+
+/* Creates the file at `path` and writes its header. Returns NULL on
+ * error. */
+struct captureFile *capture_create(const char *path);
+void capture_destroy(struct captureFile *c);
+
+/* Appends `n` records in one piece. Safe to call from any thread.
+ * Returns 0 on success, -1 on error, after which the capture is
+ * abandoned. */
+int capture_write(struct captureFile *c, const pd3_estimator_capture_record *records,
+                  unsigned int n);
+
+#endif /* _PD3_ESTIMATOR_CAPTURE_H_ */
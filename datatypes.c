@@ -59,6 +59,39 @@ void free_seqnorangelist(struct seqnoRangeList *l)
     }
 }
 
+void move_seqnobitmaplist(struct seqnoBitmapList *to, struct seqnoBitmapList *from)
+{
+    if (!from->head) {
+        return;    /* nothing to move */
+    } else if (!to->head) {    /* replace */
+        to->head = from->head;
+        to->tail = from->tail;
+    } else {    /* append */
+        to->tail->next = from->head;
+        to->tail = from->tail;
+    }
+    from->head = NULL;
+    from->tail = NULL;
+}
+
+void free_seqnobitmaplist(struct seqnoBitmapList *l)
+{
+    struct seqnoBitmap *b;
+
+    if (!l) {
+        return;
+    }
+
+    b = l->head;
+
+    while (b) {
+        struct seqnoBitmap *victim;
+        victim = b;
+        b = b->next;
+        free(victim);
+    }
+}
+
 int seqcmp(SEQNO s, SEQNO t)
 {
     SEQNO diff;
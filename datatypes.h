@@ -33,7 +33,7 @@ enum arrivalPeriod {ARR_PAST, ARR_PRESENT, ARR_FUTURE};
 struct seqnoRange {
   SEQNO low;
   SEQNO high;
-  unsigned int wraparound;      /* 1 = before wraparound, 0 = after */
+  unsigned int order;           /* a2r link order, private to a2r() */
   enum arrivalPeriod arrival_period;
   struct seqnoRange *next;
   struct seqnoRange *next_r;    /* private to a2r() routines */
@@ -45,6 +45,22 @@ struct seqnoRangeList {
   struct seqnoRange *tail;
 };
 
+/* Sequence numbers covered by one bitmap block */
+#define SEQNO_BITMAP_BITS 4096
+
+/* Block of a sequence number bitmap: bit i stands for base + i. The
+ * blocks of a list cover consecutive sequence numbers. */
+struct seqnoBitmap {
+  SEQNO base;
+  uint64_t bits[SEQNO_BITMAP_BITS / 64];
+  struct seqnoBitmap *next;
+};
+
+struct seqnoBitmapList {
+  struct seqnoBitmap *head;
+  struct seqnoBitmap *tail;
+};
+
 #ifndef min
 #define min(_x, _y)    ((_x) <= (_y) ? (_x) : (_y))
 #endif
@@ -54,6 +70,8 @@ struct seqnoRangeList {
 
 void move_seqnorangelist(struct seqnoRangeList *to, struct seqnoRangeList *from);
 void free_seqnorangelist(struct seqnoRangeList *l);
+void move_seqnobitmaplist(struct seqnoBitmapList *to, struct seqnoBitmapList *from);
+void free_seqnobitmaplist(struct seqnoBitmapList *l);
 
 int seqcmp(SEQNO s, SEQNO t);
 SEQNO modular_distance(SEQNO s, SEQNO t);
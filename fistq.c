@@ -620,6 +620,7 @@ char *fistq_type2name(fistq_data_type type)
     case FISTQ_TYPE_NULL:    name = "NULL"; break;
     case FISTQ_TYPE_TIMEOUT: name = "TIMEOUT"; break;
     case FISTQ_TYPE_PINFO:   name = "PINFO"; break;
+    case FISTQ_TYPE_PINFO_BATCH: name = "PINFO_BATCH"; break;
     default:                 name = "Undefined"; break;
     }
 
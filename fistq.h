@@ -78,6 +78,7 @@ typedef enum
     FISTQ_TYPE_TIMEOUT,
 
     FISTQ_TYPE_PINFO,
+    FISTQ_TYPE_PINFO_BATCH,
 } fistq_data_type;
 
 /************************************************************************/
@@ -23,6 +23,8 @@
  * http://www.apache.org/licenses/LICENSE-2.0
  */
 
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "crc.h"
 #include "hashmap2.h"
@@ -56,11 +58,30 @@ unsigned long hash_key(struct hashMapKey *hmk)
 
 /* hashmap items */
 
+static size_t hashmap_item_size(enum hashMapItemRole role)
+{
+    size_t header = offsetof(struct hashMapItem, value);
+
+    switch (role) {
+    case HMI_TRACKER:
+        return header + offsetof(struct reporterData, reorder) + reorderdata_size();
+    case HMI_STREAM:
+        return header + sizeof(struct streamData);
+    case HMI_AGGREGATOR:
+    default:
+        return header + sizeof(struct aggregatorData);
+    }
+}
+
 struct hashMapItem *add_hashmapitem(struct hashMapItemList *list,
                                     struct hashMapItemList *freelist)
 {
     struct hashMapItem *hmi;
+    enum hashMapItemRole role;
+    size_t size;
 
+    role = freelist ? freelist->role : HMI_AGGREGATOR;
+    size = hashmap_item_size(role);
     if (freelist && freelist->head) {
         hmi = freelist->head;
         freelist->head = hmi->next;
@@ -68,9 +89,14 @@ struct hashMapItem *add_hashmapitem(struct hashMapItemList *list,
             freelist->tail = NULL;
         }
     } else {
-        hmi = malloc(sizeof(*hmi));
+        hmi = malloc(size);
+        if (!hmi) {
+            fprintf(stderr, "malloc failed\n");
+            return NULL;
+        }
     }
-    memset(hmi, 0, sizeof(*hmi));
+    memset(hmi, 0, size);
+    hmi->role = role;
     hmi->next = list->head;
     list->head = hmi;
     if (!list->tail) {
@@ -119,6 +145,7 @@ void purge_hmilist(struct hashMapItemList *list,
 
 static struct hashMap *pop_earliest(struct hashMapList *from);
 static void push_latest(struct hashMapList *to, struct hashMap *hm);
+static void hashmap_clear_table(struct hashMap *hm);
 
 void add_hashmap(struct hashMapList *list, struct hashMapList *freelist)
 {
@@ -126,9 +153,14 @@ void add_hashmap(struct hashMapList *list, struct hashMapList *freelist)
 
     hm = pop_earliest(freelist);
     if (!hm) {
-        hm = malloc(sizeof(*hm));
+        hm = calloc(1, sizeof(*hm));
+    } else {
+        /* Keep the table storage, but forget its contents */
+        hashmap_clear_table(hm);
+        memset(&hm->items, 0, sizeof(hm->items));
+        hm->previous = NULL;
+        hm->next = NULL;
     }
-    memset(hm, 0, sizeof(*hm));
     push_latest(list, hm);
 }
 
@@ -193,97 +225,198 @@ static void push_latest(struct hashMapList *to, struct hashMap *hm)
     to->latest = hm;
 }
 
+/* Returns the slot holding key `k`, or the empty slot ending its probe
+ * sequence. `table` must not be full. */
+static struct hashMapSlot *probe(struct hashMapSlot *table, unsigned int mask,
+                                 uint32_t hash, struct hashMapKey *k)
+{
+    struct hashMapSlot *slot;
+    unsigned int i;
+
+    for (i = hash & mask; ; i = (i + 1) & mask) {
+        slot = &table[i];
+        if (!slot->item ||
+            (slot->hash == hash && equal_key(&slot->item->key, k))) {
+            return slot;
+        }
+    }
+}
+
+static void free_old_table(struct hashMap *hm)
+{
+    free(hm->old_table);
+    hm->old_table = NULL;
+    hm->old_mask = 0;
+    hm->old_next = 0;
+    hm->old_used = 0;
+}
+
+/* Moves up to `n` slots' worth of items from the previous table into
+ * the current one, releasing the previous table once it is empty */
+static void migrate(struct hashMap *hm, unsigned int n)
+{
+    struct hashMapSlot *from, *to;
+
+    while (hm->old_table && n-- > 0) {
+        from = &hm->old_table[hm->old_next];
+        if (from->item) {
+            to = probe(hm->table, hm->mask, from->hash, &from->item->key);
+            *to = *from;
+            hm->used++;
+            hm->old_used--;
+        }
+        if (hm->old_next++ == hm->old_mask || hm->old_used == 0) {
+            free_old_table(hm);
+        }
+    }
+}
+
+/* Makes room for one more item. Returns 0 on success, -1 on error. */
+static int reserve(struct hashMap *hm)
+{
+    struct hashMapSlot *table;
+    unsigned int size;
+
+    if (hm->table &&
+        (hm->used + hm->old_used + 1) * 4 <= (hm->mask + 1) * 3) {
+        return 0;
+    }
+
+    size = hm->table ? (hm->mask + 1) * 2 : HASHMAP_INITIAL_SIZE;
+    table = calloc(size, sizeof(*table));
+    if (!table) {
+        fprintf(stderr, "calloc failed\n");
+        return -1;
+    }
+
+    /* Growing again before the last growth finished is unusual; just
+     * finish it */
+    migrate(hm, hm->old_mask + 1);
+
+    if (hm->table) {
+        hm->old_table = hm->table;
+        hm->old_mask = hm->mask;
+        hm->old_next = 0;
+        hm->old_used = hm->used;
+    }
+    hm->table = table;
+    hm->mask = size - 1;
+    hm->used = 0;
+
+    return 0;
+}
+
+static struct hashMapItem *lookup(struct hashMap *hm, struct hashMapKey *k,
+                                  uint32_t hash)
+{
+    struct hashMapSlot *slot;
+
+    if (!hm->table) {
+        return NULL;
+    }
+    migrate(hm, HASHMAP_REHASH_STEP);
+
+    slot = probe(hm->table, hm->mask, hash, k);
+    if (slot->item) {
+        return slot->item;
+    }
+    if (hm->old_table) {
+        slot = probe(hm->old_table, hm->old_mask, hash, k);
+        return slot->item;
+    }
+    return NULL;
+}
+
+static void hashmap_clear_table(struct hashMap *hm)
+{
+    free_old_table(hm);
+    if (hm->table) {
+        memset(hm->table, 0, (hm->mask + 1) * sizeof(*hm->table));
+    }
+    hm->used = 0;
+}
+
 struct hashMapItem *hashmap_force(struct hashMap *hm, struct hashMapKey *k,
                                   struct hashMapItemList *freelist)
 {
-    unsigned long hash;
+    uint32_t hash;
     struct hashMapItem *hmi;
+    struct hashMapSlot *slot;
 
-    hash = hash_key(k) % HASHTABLESIZE;
-    for (hmi = hm->hash_table[hash]; hmi; hmi = hmi->hashnext) {
-        if (equal_key(&hmi->key, k)) {
-            return (hmi);
-        }
+    hash = (uint32_t) hash_key(k);
+    hmi = lookup(hm, k, hash);
+    if (hmi) {
+        return (hmi);
+    }
+    if (reserve(hm) != 0) {
+        return NULL;
     }
     hmi = add_hashmapitem(&hm->items, freelist);
+    if (!hmi) {
+        return NULL;
+    }
     memcpy(&hmi->key, k, sizeof(*k));
-    hmi->hashnext = hm->hash_table[hash];
-    hm->hash_table[hash] = hmi;
+    slot = probe(hm->table, hm->mask, hash, k);
+    slot->hash = hash;
+    slot->item = hmi;
+    hm->used++;
 
     return (hmi);
 }
 
 struct hashMapItem *hashmap_retrieve(struct hashMap *hm, struct hashMapKey *k)
 {
-    unsigned long hash;
-    struct hashMapItem *hmi;
-
-    hash = hash_key(k) % HASHTABLESIZE;
-    for (hmi = hm->hash_table[hash]; hmi; hmi = hmi->hashnext) {
-        if (equal_key(&hmi->key, k)) {
-            return (hmi);
-        }
-    }
-    return NULL;
+    return lookup(hm, k, (uint32_t) hash_key(k));
 }
 
 void purge_hashmap(struct hashMap *hm, struct hashMapItemList *freelist)
 {
-    int i;
-    struct hashMapItem **p;
-
-    /* first, remove items from hashed lists */
-    for (i = 0; i < HASHTABLESIZE; i++) {
-        for (p = hm->hash_table + i; *p;) {
-            if ((*p)->marked_for_deletion) {
-                *p = (*p)->hashnext;
-            } else {
-                p = &((*p)->hashnext);
-            }
-        }
-    }
-    /* then, remove from master list and send to freelist */
+    struct hashMapItem *hmi;
+    struct hashMapSlot *slot;
+
+    /* first, remove from master list and send to freelist */
     purge_hmilist(&hm->items, freelist);
+
+    /* then, rebuild the table from the survivors, since open
+     * addressing can't simply unlink them */
+    hashmap_clear_table(hm);
+    for (hmi = hm->items.head; hmi; hmi = hmi->next) {
+        slot = probe(hm->table, hm->mask, (uint32_t) hmi->key.hash, &hmi->key);
+        slot->hash = (uint32_t) hmi->key.hash;
+        slot->item = hmi;
+        hm->used++;
+    }
 }
 
 void zeroout_hashmap(struct hashMap *hm, struct hashMapItemList *freelist)
 {
-    unsigned int i;
-
-    for (i = 0; i < HASHTABLESIZE; i++) {
-        hm->hash_table[i] = NULL;
-    }
+    hashmap_clear_table(hm);
     move_hmilist(freelist, &hm->items);
 }
 
-static struct hashMapItem *hashlist_contains(struct hashMapItem *hmi,
-                                             struct hashMapKey *k)
+void hashmap_free_table(struct hashMap *hm)
 {
-    for (; hmi; hmi = hmi->hashnext) {
-        if (equal_key(&hmi->key, k)) {
-            return (hmi);
-        }
-    }
-    return NULL;
+    free_old_table(hm);
+    free(hm->table);
+    hm->table = NULL;
+    hm->mask = 0;
+    hm->used = 0;
 }
 
 void partition_hashmap(struct hashMapPartition *hmp,
                        struct hashMap *splitme, struct hashMap *reference)
 {
-    unsigned int i;
     struct hashMapItem *hmi;
 
     hmp->intersection = NULL;
     hmp->difference = NULL;
-    for (i = 0; i < HASHTABLESIZE; i++) {
-        for (hmi = splitme->hash_table[i]; hmi; hmi = hmi->hashnext) {
-            if (hashlist_contains(reference->hash_table[i], &hmi->key)) {
-                hmi->partitionnext = hmp->intersection;
-                hmp->intersection = hmi;
-            } else {
-                hmi->partitionnext = hmp->difference;
-                hmp->difference = hmi;
-            }
+    for (hmi = splitme->items.head; hmi; hmi = hmi->next) {
+        if (hashmap_retrieve(reference, &hmi->key)) {
+            hmi->partitionnext = hmp->intersection;
+            hmp->intersection = hmi;
+        } else {
+            hmi->partitionnext = hmp->difference;
+            hmp->difference = hmi;
         }
     }
 }
@@ -306,14 +439,20 @@ void partition_cleanup(struct hashMapPartition *hmp)
 
 static void hashmap_item_destroy(struct hashMapItem *hmi)
 {
-    reorderdata_destroy_missing_packets(&hmi->value.state_data.reorder.missingPackets);
-    reorderdata_destroy_rd_buffer(&hmi->value.state_data.reorder.RD.buffer);
-    reorderdata_destroy_rd_window(&hmi->value.state_data.reorder.RD.window);
-
-    free_seqnorangelist(&hmi->value.agg_data.reorder.ranges);
-    free_seqnorangelist(&hmi->value.agg_data.loss.ranges);
-
-    free_seqnorangelist(&hmi->value.rep_data.loss.ranges);
+    switch (hmi->role) {
+    case HMI_STREAM:
+        reorderdata_destroy_state(&hmi->value.stream_data.state.reorder);
+        break;
+    case HMI_TRACKER:
+        free_seqnorangelist(&hmi->value.rep_data.loss.ranges);
+        break;
+    case HMI_AGGREGATOR:
+    default:
+        free_seqnorangelist(&hmi->value.agg_data.reorder.ranges);
+        free_seqnorangelist(&hmi->value.agg_data.loss.ranges);
+        free_seqnobitmaplist(&hmi->value.agg_data.loss.bitmap);
+        break;
+    }
 
     /* Free the item itself */
     free(hmi);
@@ -343,6 +482,7 @@ void hashmap_list_destroy(struct hashMapList *list)
         }
         hm_victim = hm;
         hm = hm->next;
+        hashmap_free_table(hm_victim);
         free(hm_victim);
     }
 }
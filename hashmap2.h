@@ -30,7 +30,13 @@
 #include "aggregatordata.h"
 #include "reporterdata.h"
 
-#define HASHTABLESIZE 1024
+/* Initial number of slots in a hash table. Tables double in size once
+ * they are three quarters full. */
+#define HASHMAP_INITIAL_SIZE 1024
+
+/* Number of slots of the previous table migrated by each lookup while
+ * a table is growing */
+#define HASHMAP_REHASH_STEP 16
 
 /* Hashmap Keys */
 enum hashMapKeyType {
@@ -48,31 +54,80 @@ struct hashMapKey {
   unsigned long hash;
 };
 
-struct value_struct {
+/* Role of a hash map item, which determines which member of its value
+ * is in use */
+enum hashMapItemRole {
+  HMI_AGGREGATOR = 0,  /* per-period aggregator data */
+  HMI_TRACKER,         /* reporter data accumulated over a pane or report */
+  HMI_STREAM           /* persistent per-stream entry */
+};
+
+/* Persistent per-stream entry, kept by the aggregator that owns the
+ * stream for as long as the library runs. The aggregator and the
+ * reporter each own their half. */
+struct streamData {
+    /* Aggregator: the stream's item in the current period, valid if
+     * current_epoch is the current period */
+    struct hashMapItem *current;
+    unsigned int current_epoch;
+
+    /* Reporter: the stream's most recent item handed over, valid while
+     * the reporter still holds its period */
+    struct hashMapItem *latest;
+    unsigned int latest_epoch;
+
+    /* Reporter: state kept across periods */
+    struct stateData state;
+};
+
+union hashMapValue {
     struct aggregatorData agg_data;
     struct reporterData rep_data;
-    struct stateData state_data;
+    struct streamData stream_data;
 };
 
-/* Hash Map Item */
+/* Hash Map Item. Items are allocated with room for their role's value
+ * only, so an item must only be recycled through free lists of the
+ * same role. */
 struct hashMapItem {
     struct hashMapKey key;
-
-    // FIXME: revert to union to save space
-    struct value_struct value;
+    uint8_t role;
     uint8_t marked_for_deletion;
-    struct hashMapItem *hashnext;
     struct hashMapItem *next;
     struct hashMapItem *partitionnext;
+
+    /* Must be last */
+    union hashMapValue value;
 };
 
+/* A free list's role is the role of the items it hands out; zeroed
+ * lists hold aggregator items */
 struct hashMapItemList {
   struct hashMapItem *head, *tail;
+  enum hashMapItemRole role;
+};
+
+/* Open-addressing slot. The item's hash is kept alongside the pointer
+ * so that probing only touches an item whose hash matches. */
+struct hashMapSlot {
+  uint32_t hash;
+  struct hashMapItem *item;    /* NULL if the slot is empty */
 };
 
-/* Hash Map */
+/* Hash Map, with linear probing. When the table grows, the previous
+ * table is kept and migrated a few slots per lookup, so that no single
+ * insertion pays for rehashing every item. Lookups consult the current
+ * table first, then the previous one. A zeroed hashMap is a valid
+ * empty map. */
 struct hashMap {
-  struct hashMapItem *hash_table[HASHTABLESIZE];
+  unsigned int epoch;          /* aggregation period, if any */
+  struct hashMapSlot *table;
+  unsigned int mask;           /* table size - 1 */
+  unsigned int used;           /* items in table */
+  struct hashMapSlot *old_table;
+  unsigned int old_mask;
+  unsigned int old_next;       /* next old slot to migrate */
+  unsigned int old_used;       /* items left to migrate */
   struct hashMapItemList items;
   struct hashMap *previous, *next;
 };
@@ -113,6 +168,7 @@ struct hashMapItem *hashmap_force(struct hashMap *hm, struct hashMapKey *k,
 
 void purge_hashmap(struct hashMap *hm, struct hashMapItemList *freelist);
 void zeroout_hashmap(struct hashMap *hm, struct hashMapItemList *freelist);
+void hashmap_free_table(struct hashMap *hm);
 char *hashMap2String(char *, struct hashMap *);
 
 void set_streamtuple(struct hashMapKey *hmk, stream_tuple *stream);
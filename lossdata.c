@@ -30,9 +30,6 @@
 #include "datatypes.h"
 #include "hashmap2.h"
 
-// N bytes * 8 bits/byte / 2 (half the space) = N * 4
-#define WRAPAROUND    (((SEQNO) 1) << (sizeof(SEQNO) * 4))
-
 int lossdata_init()
 {
     return 0;
@@ -69,23 +66,44 @@ void lossdata_accumulate_flows(struct lossDataR *accum, struct lossDataR *unit)
     }
 }
 
-static void lossdata_a2r_begin(struct lossDataR *ldr, struct lossDataA *lda)
+/* Link `ranges` at the tail of the a2r list in arrival order. The
+ * aggregator prepends each new range, so the list is walked newest
+ * first and reversed on the way in. Each range is stamped with the
+ * running link count `order`. */
+static void lossdata_a2r_append(struct lossDataR *ldr, struct seqnoRangeList *ranges,
+                                enum arrivalPeriod arr, unsigned int *order)
 {
-    struct seqnoRange *r;
+    struct seqnoRange *r, *first = NULL;
 
-    for (r = lda->ranges.head; r; r = r->next) {
-        r->wraparound = 0;
-        r->arrival_period = ARR_PRESENT;    /* can't trust prior setting */
-        r->next_r = r->next;
+    for (r = ranges->head; r; r = r->next) {
+        r->order = (*order)++;
+        r->arrival_period = arr;
+        r->next_r = first;
+        first = r;
+    }
+    if (!first) {
+        return;
+    }
+    if (ldr->ranges.tail) {
+        ldr->ranges.tail->next_r = first;
+    } else {
+        ldr->ranges.head = first;
     }
-    ldr->ranges.head = lda->ranges.head;
-    ldr->ranges.tail = lda->ranges.tail;
+    ldr->ranges.tail = ranges->head;
+}
+
+static void lossdata_a2r_begin(struct lossDataR *ldr, struct lossDataA *lda,
+                               unsigned int *order)
+{
+    ldr->ranges.head = NULL;
+    ldr->ranges.tail = NULL;
+    lossdata_a2r_append(ldr, &lda->ranges, ARR_PRESENT, order);
 }
 
 static void lossdata_a2r_add(struct lossDataR *ldr, struct seqnoRange *r,
-                             enum arrivalPeriod arr)
+                             enum arrivalPeriod arr, unsigned int *order)
 {
-    r->wraparound = 0;
+    r->order = (*order)++;
     r->arrival_period = arr;
     r->next_r = ldr->ranges.head;
     ldr->ranges.head = r;
@@ -94,161 +112,402 @@ static void lossdata_a2r_add(struct lossDataR *ldr, struct seqnoRange *r,
     }
 }
 
-static int rangecmp(const void *x, const void *y)
+/* Position of `seqno` in a 64-bit sequence space unwrapped around
+ * `ref`: sequence numbers less than half the space away from `ref`
+ * keep their order across a wraparound of SEQNO. */
+static inline int64_t unwrap(SEQNO ref, SEQNO seqno)
 {
-    struct seqnoRange *rx, *ry;
+    return (int64_t) ref + (int32_t) (seqno - ref);
+}
 
-    rx = *((struct seqnoRange **) x);
-    ry = *((struct seqnoRange **) y);
-    if (rx->wraparound != ry->wraparound) {
-        return (ry->wraparound - rx->wraparound);
-    } else {
-        return (rx->low - ry->low);
+/* Ranges starting at the same sequence number are ordered future
+ * first, then past, then present, so that a future range never falls
+ * after the ARR_PAST marker that begins the computation. Future ranges
+ * are taken latest linked first and present ones newest first. */
+static const int tie_rank[] = {
+    [ARR_FUTURE] = 0,
+    [ARR_PAST] = 1,
+    [ARR_PRESENT] = 2,
+};
+
+static int rangecmp(SEQNO ref, struct seqnoRange *rx, struct seqnoRange *ry)
+{
+    int64_t x = unwrap(ref, rx->low);
+    int64_t y = unwrap(ref, ry->low);
+
+    if (x != y) {
+        return (x < y) ? -1 : 1;
+    }
+    if (rx->arrival_period != ry->arrival_period) {
+        return tie_rank[rx->arrival_period] - tie_rank[ry->arrival_period];
     }
+    if (rx->arrival_period == ARR_FUTURE) {
+        return (ry->order < rx->order) ? -1 : (ry->order > rx->order);
+    }
+    return (rx->order < ry->order) ? -1 : (rx->order > ry->order);
 }
 
-static struct seqnoRange **a2rarray;
-static unsigned int a2rarraysize;
-static uint8_t lossdata_a2r_compute(struct lossDataR *ldr, struct lossState *state,  SEQNO *present_high)
+/* Merge the sorted lists `a` and `b`. Returns the head of the result
+ * and stores its last range in `*tail`. */
+static struct seqnoRange *lossdata_a2r_merge(struct seqnoRange *a, struct seqnoRange *b,
+                                             SEQNO ref, struct seqnoRange **tail)
 {
-    struct seqnoRange **array;
-    unsigned int arraysize;
-    unsigned int n, i, begin, end, gap, recd;
-    struct seqnoRange *r;
+    struct seqnoRange *head = NULL, **out = &head;
 
-    /* count ranges and make sure array is large enough */
-    for (n = 0, r = ldr->ranges.head; r; n++, r = r->next_r) {
+    while (a && b) {
+        if (rangecmp(ref, b, a) < 0) {
+            *out = b;
+            b = b->next_r;
+        } else {
+            *out = a;
+            a = a->next_r;
+        }
+        *tail = *out;
+        out = &(*tail)->next_r;
+    }
+    for (*out = a ? a : b; *out; out = &(*tail)->next_r) {
+        *tail = *out;
     }
 
-    if (n == 0) {
-        return 0;
+    return head;
+}
+
+/* Cut the ascending run starting at `r` from the a2r list. Returns
+ * the rest of the list. */
+static struct seqnoRange *lossdata_a2r_run(struct seqnoRange *r, SEQNO ref)
+{
+    struct seqnoRange *rest;
+
+    while (r->next_r && rangecmp(ref, r, r->next_r) <= 0) {
+        r = r->next_r;
     }
+    rest = r->next_r;
+    r->next_r = NULL;
 
-    array = a2rarray;
-    arraysize = a2rarraysize;
+    return rest;
+}
 
-    if (n > arraysize) {
-        if (array) {
-            free(array);
+/* Natural merge sort: each pass merges pairs of ascending runs. */
+static struct seqnoRange *lossdata_a2r_mergesort(struct seqnoRange *head, SEQNO ref,
+                                                 struct seqnoRange **tail)
+{
+    struct seqnoRange *in, *a, *b, **out;
+    unsigned int merged;
+
+    do {
+        merged = 0;
+        out = &head;
+        for (in = head; in; merged++) {
+            a = in;
+            in = lossdata_a2r_run(a, ref);
+            b = in;
+            if (b) {
+                in = lossdata_a2r_run(b, ref);
+            }
+            *out = lossdata_a2r_merge(a, b, ref, tail);
+            out = &(*tail)->next_r;
+        }
+    } while (merged > 1);
+
+    return head;
+}
+
+/* Sort the a2r list by sequence number unwrapped around `ref`. The
+ * list is linked in arrival order, so for a lightly reordered stream
+ * nearly every range extends the ascending run of those before it. A
+ * single pass keeps that run and sets the few out-of-order ranges
+ * aside; only these are sorted before being merged back in. Loss
+ * computation for an in-order stream is thus linear, and never worse
+ * than O(n log n). */
+static void lossdata_a2r_sort(struct seqnoRangeList *ranges, SEQNO ref)
+{
+    struct seqnoRange *r, *next, *main_tail, *rest = NULL, *rest_tail;
+    struct seqnoRange **out = &rest;
+
+    main_tail = ranges->head;
+    for (r = main_tail->next_r; r; r = next) {
+        next = r->next_r;
+        if (rangecmp(ref, main_tail, r) <= 0) {
+            main_tail->next_r = r;
+            main_tail = r;
+        } else {
+            *out = r;
+            out = &r->next_r;
         }
-        array = a2rarray = calloc(n, sizeof(struct seqnoRange *));
-        a2rarraysize = n;
     }
+    main_tail->next_r = NULL;
+    *out = NULL;
 
-    /* copy to array and sort */
-    for (i = 0, r = ldr->ranges.head; r; i++, r = r->next_r) {
-        array[i] = r;
+    ranges->tail = main_tail;
+    if (rest) {
+        rest = lossdata_a2r_mergesort(rest, ref, &rest_tail);
+        ranges->head = lossdata_a2r_merge(ranges->head, rest, ref, &ranges->tail);
     }
+}
 
-    qsort(array, n, sizeof(struct seqnoRange *), rangecmp);
+/* Index of the first bit of `b` at or after `i` that is set, or
+ * clear if `set` is 0. Returns SEQNO_BITMAP_BITS if there is none. */
+static unsigned int bitmap_find(struct seqnoBitmap *b, unsigned int i, int set)
+{
+    unsigned int w = i / 64;
+    uint64_t word;
 
-    /* detect wraparound */
-    if (WRAPAROUND != 0) {
-        for (i = 0; i < n; i++) {
-            r = array[i];
-            r->wraparound = 1;    /* harmless if all marked as wrapping around */
-            if (i < n - 1 && array[i+1]->low - r->high > (WRAPAROUND / 2)) {
-                qsort((void *) array, n, sizeof (struct seqnoRange *), rangecmp);
-                break;
-            }
+    if (i >= SEQNO_BITMAP_BITS) {
+        return SEQNO_BITMAP_BITS;
+    }
+    word = (set ? b->bits[w] : ~b->bits[w]) & (~(uint64_t) 0 << (i % 64));
+    while (!word) {
+        if (++w == SEQNO_BITMAP_BITS / 64) {
+            return SEQNO_BITMAP_BITS;
         }
+        word = set ? b->bits[w] : ~b->bits[w];
     }
 
-#ifdef RANGE_DEBUG
-    for (i = 0; i < n; i++) {
-        r = array[i];
-        fprintf(stderr, "Range %u: [%u, %u]\n", i, r->low, r->high);
-    }
-    fprintf(stderr, "\n");
-#endif
+    return w * 64 + __builtin_ctzll(word);
+}
+
+/* Move `c` to the next run of set bits, which may span blocks. Whole
+ * words of clear or set bits are skipped at once. Like ranges, runs
+ * are cut where sequence numbers wrap around to 0. */
+static void lossdata_a2r_cursor_advance(struct lossBitmapCursor *c)
+{
+    struct seqnoBitmap *b = c->block;
+    unsigned int i = c->bit, j, zero;
 
-    /* begin at [0] or first array element after ARR_PAST */
-    /* end at final array element that isn't ARR_FUTURE */
-    for (begin = 0, end = n, i = 0; i < n; i++) {
-        if (array[i]->arrival_period == ARR_PAST) {
-            begin = i + 1;
+    while (b && (i = bitmap_find(b, i, 1)) == SEQNO_BITMAP_BITS) {
+        b = b->next;
+        i = 0;
+    }
+    if (!b) {
+        c->block = NULL;
+        return;
+    }
+    c->run.low = b->base + i;
+    for (;;) {
+        j = bitmap_find(b, i, 0);
+        zero = (SEQNO) (0 - b->base);
+        if (zero < j && (zero > i || (zero == i && c->run.low != b->base + i))) {
+            j = zero;
+            break;
         }
-        if (array[i]->arrival_period != ARR_FUTURE) {
-            end = i;
+        if (j < SEQNO_BITMAP_BITS || !b->next) {
+            break;
         }
+        b = b->next;
+        i = 0;
     }
-    if (end >= n) {
-        return (0);
+    c->run.high = b->base + j - 1;
+    c->block = b;
+    c->bit = j;
+}
+
+/* Link the bitmap of `lda`, if any, into the a2r list of bitmaps. Its
+ * runs of received sequence numbers take part in the computation as
+ * ranges of the given arrival period. */
+static void lossdata_a2r_bitmap(struct lossDataA **bitmaps, struct lossDataA *lda,
+                                enum arrivalPeriod arr, unsigned int *order)
+{
+    struct lossBitmapCursor *c = &lda->cursor;
+
+    if (!lda->bitmap.head) {
+        return;
     }
+    memset(c, 0, sizeof(*c));
+    c->block = lda->bitmap.head;
+    c->run.order = (*order)++;
+    c->run.arrival_period = arr;
+    lossdata_a2r_cursor_advance(c);
+    c->next = *bitmaps;
+    *bitmaps = lda;
+}
 
-    /* compute */
-    SEQNO base;
-
-    /* If this is the first range, pretend like we got the packet just
-     * before this one so that we're sure to process this one. */
-    if (!state->has_last_range) {
-        memset(&state->last_range, 0, sizeof(state->last_range));
-        state->last_range.low = array[begin]->low - 1;
-        state->last_range.high = array[begin]->low - 1;
-        state->has_last_range = 1;
-    }
-
-    /* Base from which we compute distances */
-    base = state->last_range.high;
-    for (i = begin; i <= end; i++) {
-        struct seqnoRange *prev = &state->last_range;;
-        r = array[i];
-        SEQNO d_prev_high = modular_distance(base, prev->high);
-        SEQNO d_this_low = modular_distance(base, r->low);
-        SEQNO d_this_high = modular_distance(base, r->high);
-
-        /* If this range overlaps with the previous one */
-        if (d_this_low <= d_prev_high) {
-            /* This range is subsumed by the previous one. Skip it. */
-            if (d_this_high <= d_prev_high) {
-                continue;
-            }
-            /* Otherwise, rewrite the low side of this range to be one
-             * more than the overlap point. Example: (1, 5), (4,
-             * 6). When considering (4, 6), rewrite the low end to
-             * 6. Since the numbers are unsigned, we get modular
-             * arithmetic for free. */
-            r->low = min(r->high, prev->high) + 1;
+/* Returns the lowest of the head of the sorted list `*list` and the
+ * current runs of `bitmaps`, and moves past it. A run is returned as a
+ * copy in `run`, since its cursor moves on. */
+static struct seqnoRange *lossdata_a2r_next(struct seqnoRange **list, struct lossDataA *bitmaps,
+                                            SEQNO ref, struct seqnoRange *run)
+{
+    struct seqnoRange *r = *list;
+    struct lossDataA *lda, *from = NULL;
+
+    for (lda = bitmaps; lda; lda = lda->cursor.next) {
+        if (lda->cursor.block && (!r || rangecmp(ref, &lda->cursor.run, r) < 0)) {
+            r = &lda->cursor.run;
+            from = lda;
         }
-        /* Make sure we don't wrap around to base. Since the numbers
-         * are unsigned, we get modular arithmetic for free. */
-        if (r->high < r->low) {
-            r->high = base - 1;
+    }
+    if (from) {
+        *run = *r;
+        lossdata_a2r_cursor_advance(&from->cursor);
+        return run;
+    }
+    if (r) {
+        *list = r->next_r;
+    }
+
+    return r;
+}
+
+/* Account for range `r`, the next one in sequence order */
+static void lossdata_a2r_range(struct lossDataR *ldr, struct lossState *state,
+                               SEQNO base, struct seqnoRange *r)
+{
+    struct seqnoRange *prev = &state->last_range;;
+    SEQNO d_prev_high = modular_distance(base, prev->high);
+    SEQNO d_this_low = modular_distance(base, r->low);
+    SEQNO d_this_high = modular_distance(base, r->high);
+    unsigned int gap, recd;
+
+    /* If this range overlaps with the previous one */
+    if (d_this_low <= d_prev_high) {
+        /* This range is subsumed by the previous one. Skip it. */
+        if (d_this_high <= d_prev_high) {
+            return;
         }
+        /* Otherwise, rewrite the low side of this range to be one
+         * more than the overlap point. Example: (1, 5), (4,
+         * 6). When considering (4, 6), rewrite the low end to
+         * 6. Since the numbers are unsigned, we get modular
+         * arithmetic for free. */
+        r->low = min(r->high, prev->high) + 1;
+    }
+    /* Make sure we don't wrap around to base. Since the numbers
+     * are unsigned, we get modular arithmetic for free. */
+    if (r->high < r->low) {
+        r->high = base - 1;
+    }
 
-        recd = r->high - r->low + 1;    /* shouldn't be 0 */
+    recd = r->high - r->low + 1;    /* shouldn't be 0 */
 
-        SEQNO distance = modular_distance(prev->high, r->low);
-        /* Example: (x, 4), (7, y) --> distance = 3, gap = 2 (for
-         * sequence numbers 5 and 6) */
-        gap = (distance > 0) ? distance - 1 : 0;
+    SEQNO distance = modular_distance(prev->high, r->low);
+    /* Example: (x, 4), (7, y) --> distance = 3, gap = 2 (for
+     * sequence numbers 5 and 6) */
+    gap = (distance > 0) ? distance - 1 : 0;
 
-        /* Update the last processed range */
-        state->last_range = *r;
+    /* Update the last processed range */
+    state->last_range = *r;
 
-        /* Update the tallies */
-        ldr->received += recd;
-        ldr->dropped += gap;
+    /* Update the tallies */
+    ldr->received += recd;
+    ldr->dropped += gap;
 
-        if (gap > 1) {
-            ldr->consecutive_drops += gap - 1;
+    if (gap > 1) {
+        ldr->consecutive_drops += gap - 1;
+    }
+    if (gap > 0) {
+        if (ldr->gap_count == 0 || gap < ldr->gap_min) {
+            ldr->gap_min = gap;
+        }
+        if (ldr->gap_count == 0 || gap > ldr->gap_max) {
+            ldr->gap_max = gap;
         }
-        if (gap > 0) {
-            if (ldr->gap_count == 0 || gap < ldr->gap_min) {
-                ldr->gap_min = gap;
+        ldr->gap_total += gap;
+        ldr->gap_count++;
+    }
+}
+
+/* Computes loss over the ranges of the a2r list and the runs of
+ * `bitmaps`, merged in sequence order. `present` is the current
+ * period's bitmap, if any. */
+static uint8_t lossdata_a2r_compute(struct lossDataR *ldr, struct lossState *state,
+                                    struct lossDataA *bitmaps, struct lossDataA *present,
+                                    SEQNO *present_high)
+{
+    struct seqnoRange *r, *list, *past, *end, run;
+    struct lossDataA *lda;
+    uint8_t begun, ended, has_base = 0;
+    SEQNO ref, base = 0;
+
+    /* Sequence numbers are unwrapped around the lowest start of any
+     * range or run, so that none of them compares as wrapped. The
+     * ARR_PAST marker at the head may lie above present runs. */
+    if (ldr->ranges.head) {
+        ref = ldr->ranges.head->low;
+    } else if (bitmaps) {
+        ref = bitmaps->cursor.run.low;
+    } else {
+        return 0;
+    }
+    for (r = ldr->ranges.head; r; r = r->next_r) {
+        if (seqcmp(r->low, ref) < 0) {
+            ref = r->low;
+        }
+    }
+    for (lda = bitmaps; lda; lda = lda->cursor.next) {
+        if (lda->cursor.block && seqcmp(lda->cursor.run.low, ref) < 0) {
+            ref = lda->cursor.run.low;
+        }
+    }
+    if (ldr->ranges.head) {
+        lossdata_a2r_sort(&ldr->ranges, ref);
+    }
+
+#ifdef RANGE_DEBUG
+    unsigned int i;
+    for (i = 0, r = ldr->ranges.head; r; i++, r = r->next_r) {
+        fprintf(stderr, "Range %u: [%u, %u]\n", i, r->low, r->high);
+    }
+    fprintf(stderr, "\n");
+#endif
+
+    /* begin after ARR_PAST, if any */
+    /* end at final range that isn't ARR_FUTURE */
+    past = end = NULL;
+    for (r = ldr->ranges.head; r; r = r->next_r) {
+        if (r->arrival_period == ARR_PAST) {
+            past = r;
+        }
+        if (r->arrival_period != ARR_FUTURE) {
+            end = r;
+        }
+    }
+    if (present && !present->cursor.block) {
+        present = NULL;    /* no runs */
+    }
+    if (!end && !present) {
+        return (0);
+    }
+
+    /* compute */
+    begun = !past;
+    ended = !end;
+    list = ldr->ranges.head;
+    while ((r = lossdata_a2r_next(&list, bitmaps, ref, &run))) {
+        if (!begun) {
+            begun = (r == past);
+        } else {
+            /* If this is the first range, pretend like we got the
+             * packet just before this one so that we're sure to
+             * process this one. */
+            if (!state->has_last_range) {
+                memset(&state->last_range, 0, sizeof(state->last_range));
+                state->last_range.low = r->low - 1;
+                state->last_range.high = r->low - 1;
+                state->has_last_range = 1;
             }
-            if (ldr->gap_count == 0 || gap > ldr->gap_max) {
-                ldr->gap_max = gap;
+            if (!has_base) {
+                /* Base from which we compute distances */
+                base = state->last_range.high;
+                has_base = 1;
             }
-            ldr->gap_total += gap;
-            ldr->gap_count++;
+
+            /* Future ranges count only up to the final one that isn't */
+            if (r->arrival_period == ARR_FUTURE &&
+                ended && !(present && present->cursor.block)) {
+                break;
+            }
+            lossdata_a2r_range(ldr, state, base, r);
+        }
+        if (r == end) {
+            ended = 1;
+        }
+        if (r->arrival_period != ARR_FUTURE) {
+            *present_high = r->high;
         }
     }
 
     /* cleanup */
-    *present_high = array[end]->high;
     for (r = ldr->ranges.head; r; r = r->next_r) {
-        r->wraparound = 0;
         r->arrival_period = ARR_PRESENT;
         r->next_r = NULL;
     }
@@ -258,59 +517,165 @@ static uint8_t lossdata_a2r_compute(struct lossDataR *ldr, struct lossState *sta
     return 1;
 }
 
-void lossdata_destroy_a2r_compute_array()
-{
-    if (a2rarray) {
-        free(a2rarray);
-        a2rarray = NULL;
-        a2rarraysize = 0;
-    }
-}
-
 void lossdata_a2r(struct lossDataR *ldr, struct lossDataA *lda,
-                  struct lossState *lstate, void *future, void *key,
+                  struct lossState *lstate, void *item,
                   unsigned int periods_to_wait)
 {
-    struct seqnoRange past_seqno, *range;
-    unsigned int i;
-    struct hashMap *hm_f;
+    struct seqnoRange past_seqno;
+    struct aggregatorData *ad = &((struct hashMapItem *) item)->value.agg_data;
     struct hashMapItem *hmi_af;
-    SEQNO present_high;
+    struct lossDataA *bitmaps = NULL;
+    SEQNO present_high = 0;
+    unsigned int order = 0;
 
     /* initialize with data from current aggregator period */
-    lossdata_a2r_begin(ldr, lda);
+    lossdata_a2r_begin(ldr, lda, &order);
+    lossdata_a2r_bitmap(&bitmaps, lda, ARR_PRESENT, &order);
     ldr->flowstate = lda->flowstate;
 
     /* create fake range for past, if not delimited */
     if (flowstate_beginp(lda->flowstate) && lstate->has_high_seqno) {
         past_seqno.low = lstate->high_seqno;
         past_seqno.high = lstate->high_seqno;
-        lossdata_a2r_add(ldr, &past_seqno, ARR_PAST);
+        lossdata_a2r_add(ldr, &past_seqno, ARR_PAST, &order);
     }
 
     /* link in ranges from the future */
-    for (i = 1, hm_f = future; i < periods_to_wait && hm_f; i++, hm_f = hm_f->next) {
-        hmi_af = hashmap_retrieve(hm_f, (struct hashMapKey *) key);
-        if (hmi_af) {
-            for (range = hmi_af->value.agg_data.loss.ranges.head; range; range = range->next) {
-                lossdata_a2r_add(ldr, range, ARR_FUTURE);
-            }
-        }
+    for (hmi_af = ad->next_period;
+         hmi_af && hmi_af->value.agg_data.epoch - ad->epoch < periods_to_wait;
+         hmi_af = hmi_af->value.agg_data.next_period) {
+        lossdata_a2r_append(ldr, &hmi_af->value.agg_data.loss.ranges, ARR_FUTURE, &order);
+        lossdata_a2r_bitmap(&bitmaps, &hmi_af->value.agg_data.loss, ARR_FUTURE, &order);
     }
 
     /* compute loss-related metric values, store high seqno for next time */
     lstate->has_high_seqno = 0;
-    if (lossdata_a2r_compute(ldr, lstate, &present_high)) {
+    if (lossdata_a2r_compute(ldr, lstate, bitmaps, lda->bitmap.head ? lda : NULL,
+                             &present_high)) {
         lstate->has_high_seqno = 1;
         lstate->high_seqno = present_high;
     }
 }
 
-int lossdata_arrival(struct lossDataA *lda, SEQNO seqno, struct seqnoRangeList *free_ranges)
+static struct seqnoBitmap *lossdata_bitmap_block(struct seqnoBitmapList *free_bitmaps, SEQNO base)
+{
+    struct seqnoBitmap *b;
+
+    if (free_bitmaps && free_bitmaps->head) {
+        b = free_bitmaps->head;
+        free_bitmaps->head = b->next;
+        if (b == free_bitmaps->tail) {
+            free_bitmaps->tail = NULL;
+        }
+    } else {
+        b = malloc(sizeof(*b));
+        if (!b) {
+            fprintf(stderr, "malloc failed\n");
+            return NULL;
+        }
+    }
+    memset(b->bits, 0, sizeof(b->bits));
+    b->base = base;
+    b->next = NULL;
+
+    return b;
+}
+
+/* Mark `seqno` received in the bitmap of `lda`, which slides forward
+ * block by block as sequence numbers advance. Returns -1 if `seqno`
+ * precedes the bitmap or lies beyond LOSS_BITMAP_MAX_BLOCKS of it. */
+static int lossdata_bitmap_set(struct lossDataA *lda, SEQNO seqno,
+                               struct seqnoBitmapList *free_bitmaps)
+{
+    struct seqnoBitmapList *l = &lda->bitmap;
+    struct seqnoBitmap *b;
+    SEQNO off = seqno - l->head->base;
+    unsigned int i;
+
+    if (off >= (SEQNO) LOSS_BITMAP_MAX_BLOCKS * SEQNO_BITMAP_BITS) {
+        return -1;
+    }
+    /* Extend only past the latest block: an offset below it falls in
+     * an earlier block, found below */
+    while (off >= (SEQNO) (l->tail->base - l->head->base) + SEQNO_BITMAP_BITS) {
+        b = lossdata_bitmap_block(free_bitmaps, l->tail->base + SEQNO_BITMAP_BITS);
+        if (!b) {
+            return -1;
+        }
+        l->tail->next = b;
+        l->tail = b;
+    }
+
+    /* Usually the latest block; a late arrival is looked up from the
+     * first one */
+    b = l->tail;
+    if ((SEQNO) (seqno - b->base) >= SEQNO_BITMAP_BITS) {
+        for (b = l->head; (SEQNO) (seqno - b->base) >= SEQNO_BITMAP_BITS; b = b->next) {
+        }
+    }
+    i = seqno - b->base;
+    b->bits[i / 64] |= (uint64_t) 1 << (i % 64);
+
+    return 0;
+}
+
+/* Move the ranges of `lda` into a bitmap starting at the lowest
+ * sequence number received. Ranges that do not fit in it are kept. */
+static void lossdata_to_bitmap(struct lossDataA *lda, struct seqnoRangeList *free_ranges,
+                               struct seqnoBitmapList *free_bitmaps)
+{
+    struct seqnoRange *r, **p;
+    SEQNO base, s;
+    int ret;
+
+    base = lda->ranges.head->low;
+    for (r = lda->ranges.head; r; r = r->next) {
+        if (seqcmp(r->low, base) < 0) {
+            base = r->low;
+        }
+    }
+    lda->bitmap.head = lda->bitmap.tail = lossdata_bitmap_block(free_bitmaps, base);
+    if (!lda->bitmap.head) {
+        return;
+    }
+
+    for (p = &lda->ranges.head, lda->ranges.tail = NULL; (r = *p); ) {
+        if (r->high - base >= (SEQNO) LOSS_BITMAP_MAX_BLOCKS * SEQNO_BITMAP_BITS ||
+            r->high - base < r->low - base) {
+            lda->ranges.tail = r;
+            p = &r->next;
+            continue;
+        }
+        for (s = r->low; (ret = lossdata_bitmap_set(lda, s, free_bitmaps)) == 0 && s != r->high; s++) {
+        }
+        if (ret) {
+            /* out of memory: keep the rest as a range */
+            r->low = s;
+            lda->ranges.tail = r;
+            p = &r->next;
+            continue;
+        }
+        *p = r->next;
+        if (free_ranges) {
+            r->next = free_ranges->head;
+            free_ranges->head = r;
+            if (!free_ranges->tail) {
+                free_ranges->tail = r;
+            }
+        } else {
+            free(r);
+        }
+    }
+}
+
+int lossdata_arrival(struct lossDataA *lda, SEQNO seqno, struct seqnoRangeList *free_ranges,
+                     struct seqnoBitmapList *free_bitmaps)
 {
     struct seqnoRange *newrange;
 
-    if (lda->ranges.head && lda->ranges.head->high == seqno - 1 && seqno != 0) {
+    if (lda->bitmap.head && lossdata_bitmap_set(lda, seqno, free_bitmaps) == 0) {
+        /* recorded in the bitmap */
+    } else if (lda->ranges.head && lda->ranges.head->high == seqno - 1 && seqno != 0) {
         lda->ranges.head->high = seqno;  /* next packet in sequence, no wraparound */
     } else {
         if (free_ranges && free_ranges->head) {
@@ -334,6 +699,9 @@ int lossdata_arrival(struct lossDataA *lda, SEQNO seqno, struct seqnoRangeList *
         if (!lda->ranges.tail) {
             lda->ranges.tail = newrange;
         }
+        if (++lda->nranges == LOSS_BITMAP_THRESHOLD && !lda->bitmap.head) {
+            lossdata_to_bitmap(lda, free_ranges, free_bitmaps);
+        }
     }
     lda->flowstate = flowstate_packet(lda->flowstate);
 
@@ -29,9 +29,37 @@
 #include "datatypes.h"
 #include "flowstate.h"
 
+/* Once a stream holds this many ranges in a period, the sequence
+ * numbers it receives for the rest of the period are recorded in a
+ * bitmap instead, so heavy loss or reordering costs one bit per
+ * sequence number rather than one range per packet. */
+#ifndef LOSS_BITMAP_THRESHOLD
+#define LOSS_BITMAP_THRESHOLD 64
+#endif
+
+/* Maximum number of bitmap blocks per stream and period. Sequence
+ * numbers beyond the span they cover are recorded as ranges. */
+#ifndef LOSS_BITMAP_MAX_BLOCKS
+#define LOSS_BITMAP_MAX_BLOCKS 256
+#endif
+
+struct lossDataA;
+
+/* Position of the reporter in a bitmap while it walks the runs of
+ * received sequence numbers */
+struct lossBitmapCursor {
+  struct seqnoBitmap *block;       /* NULL past the last run */
+  unsigned int bit;
+  struct seqnoRange run;           /* current run */
+  struct lossDataA *next;
+};
+
 struct lossDataA {
   struct seqnoRangeList ranges;    /* linked with next pointer */
   enum flowState flowstate;
+  unsigned int nranges;
+  struct seqnoBitmapList bitmap;   /* empty until nranges reaches LOSS_BITMAP_THRESHOLD */
+  struct lossBitmapCursor cursor;  /* private to a2r() routines */
 };
 
 struct lossDataR {
@@ -64,10 +92,11 @@ struct lossState {
 
 /* Returns 0 on success, -1 on error */
 int lossdata_init(void);
-int lossdata_arrival(struct lossDataA *lda, SEQNO seqno, struct seqnoRangeList *free_ranges);
+int lossdata_arrival(struct lossDataA *lda, SEQNO seqno, struct seqnoRangeList *free_ranges,
+                     struct seqnoBitmapList *free_bitmaps);
 void lossdata_birthdeath(struct lossDataA *ld);
 void lossdata_a2r(struct lossDataR *ldr, struct lossDataA *lda,
-                  struct lossState *lstate, void *future, void *key,
+                  struct lossState *lstate, void *item,
                   unsigned int periods_to_wait);
 void lossdata_accumulate_time(struct lossDataR *accum, struct lossDataR *unit);
 void lossdata_accumulate_flows(struct lossDataR *accum, struct lossDataR *unit);
@@ -76,6 +105,5 @@ char *lossdata_tostringR(char *s, struct lossDataR *ldr);
 char *lossstate_tostring(char *s, struct lossState *ls);
 char *lossdata_debugA(char *s, struct lossDataA *lda);
 char *lossdata_debugR(char *s, struct lossDataR *ldr);
-void lossdata_destroy_a2r_compute_array(void);
 
 #endif /* _PD3_ESTIMATOR_LOSSDATA_H_ */
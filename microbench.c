@@ -0,0 +1,756 @@
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+/* Microbenchmarks of each stage of the pipeline, from pushing packet
+ * infos to generating reports. Each benchmark runs a fixed, seeded
+ * workload several times and reports the median and best time per
+ * operation, and the allocations per operation, as JSON.
+ *
+ * The program is linked against the library's objects rather than
+ * the shared library, so that it can drive the internal modules
+ * directly, and with the allocation functions wrapped to count
+ * calls. */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "pd3_estimator.h"
+#include "datatypes.h"
+#include "hashmap2.h"
+#include "lossdata.h"
+#include "reorderdata.h"
+
+#define BENCH_DEFAULT_RUNS 5
+
+/* Longest wait for the pipeline to deliver a report, in seconds */
+#define BENCH_REPORT_TIMEOUT 60
+
+/************************ Allocation counting ********************/
+
+static _Atomic unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_posix_memalign(memptr, alignment, size);
+}
+
+/************************ Measurement ****************************/
+
+/* One timed run: elapsed time and allocations over `ops` operations */
+struct benchRun {
+    double ns;
+    unsigned long allocs;
+    unsigned long ops;
+};
+
+struct benchTimer {
+    struct timespec start;
+    unsigned long allocs;
+};
+
+static void timer_start(struct benchTimer *t)
+{
+    t->allocs = atomic_load(&allocations);
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+static void timer_stop(struct benchTimer *t, struct benchRun *run, unsigned long ops)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run->ns = (end.tv_sec - t->start.tv_sec) * 1e9 + (end.tv_nsec - t->start.tv_nsec);
+    run->allocs = atomic_load(&allocations) - t->allocs;
+    run->ops = ops;
+}
+
+static FILE *out;
+static unsigned int runs = BENCH_DEFAULT_RUNS;
+static int emitted = 0;
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Writes the JSON record of a benchmark. `param` names its single
+ * parameter, whose value is `value`, in JSON. */
+static void emit(const char *name, const char *param, const char *value,
+                 struct benchRun *r, unsigned int n)
+{
+    double ns_per_op[n], allocs = 0;
+    unsigned long ops = 0;
+    unsigned int valid = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        if (r[i].ops == 0) {
+            continue;
+        }
+        ops = r[i].ops;
+        ns_per_op[valid++] = r[i].ns / r[i].ops;
+        allocs += (double) r[i].allocs / r[i].ops;
+    }
+    if (valid == 0) {
+        fprintf(stderr, "%s %s=%s: no valid run\n", name, param, value);
+        return;
+    }
+    qsort(ns_per_op, valid, sizeof(double), cmp_double);
+
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"params\": {\"%s\": %s}, "
+            "\"runs\": %u, \"ops_per_run\": %lu, \"ns_per_op\": %.2f, "
+            "\"ns_per_op_min\": %.2f, \"allocs_per_op\": %.4f}",
+            emitted++ ? "," : "", name, param, value, valid, ops,
+            ns_per_op[valid / 2], ns_per_op[0], allocs / valid);
+    fflush(out);
+    fprintf(stderr, "%-16s %-14s %10.2f ns/op %10.4f allocs/op\n", name, value,
+            ns_per_op[valid / 2], allocs / valid);
+}
+
+/* Deterministic generator, so that every run sees the same workload */
+static inline uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void set_stream(stream_tuple *st, unsigned int i)
+{
+    memset(st, 0, sizeof(*st));
+    for (unsigned int b = 0; b < PD3_ESTIMATOR_KEY_SIZE && b < sizeof(i); b++) {
+        st->flow_key[b] = (uint8_t) (i >> (8 * b));
+    }
+    st->stream_id = (STREAM_ID) (i >> (8 * PD3_ESTIMATOR_KEY_SIZE));
+}
+
+/************************ Pipeline helpers ***********************/
+
+/* Virtual time at which the pipeline benchmarks start */
+#define BENCH_CLOCK_START 1000000000000ull
+#define BENCH_INTERVAL_US 100000
+
+/* Flows and packets delivered to the batch callback so far */
+static _Atomic unsigned long delivered_flows;
+static _Atomic unsigned long delivered_packets;
+static _Atomic unsigned long delivered_allocs;
+static struct timespec delivered_at;
+
+static void count_batch(void *context, pd3_estimator_results *results, size_t count)
+{
+    unsigned long packets = 0;
+
+    (void) context;
+    for (size_t i = 0; i < count; i++) {
+        packets += results[i].packet_count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &delivered_at);
+    atomic_store(&delivered_allocs, atomic_load(&allocations));
+    atomic_fetch_add(&delivered_packets, packets);
+    atomic_fetch_add(&delivered_flows, count);
+}
+
+/* Starts the pipeline on the virtual clock, reporting every period */
+static int pipeline_start(unsigned int aggregators, unsigned int ring)
+{
+    pd3_estimator_options options;
+    pd3_estimator_callbacks callbacks;
+
+    memset(&options, 0, sizeof(options));
+    options.aggregation_interval = BENCH_INTERVAL_US / 1e6;
+    options.reporter_schedule = "c,0.1,0";
+    options.reporter_min_batches = 1;
+    options.measure_loss = true;
+    options.measure_reorder_extent = true;
+    options.measure_reorder_density = true;
+    options.num_aggregators = aggregators;
+    options.ring_size = ring;
+    options.virtual_clock = true;
+    options.virtual_clock_start = BENCH_CLOCK_START;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.batch_cb = count_batch;
+
+    atomic_store(&delivered_flows, 0);
+    atomic_store(&delivered_packets, 0);
+    return pd3_estimator_init(&options, &callbacks);
+}
+
+/* Waits until `*counter` reaches `target`. Returns 0 on success, -1
+ * on timeout. */
+static int wait_for(_Atomic unsigned long *counter, unsigned long target)
+{
+    for (unsigned int i = 0; i < BENCH_REPORT_TIMEOUT * 1000; i++) {
+        if (atomic_load(counter) >= target) {
+            return 0;
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "timed out waiting for a report\n");
+    return -1;
+}
+
+/* Pushes `n` packet infos, a vector at a time, retrying while rings
+ * are full */
+static void push_all(pd3_estimator_handle *h, pd3_estimator_packet_info *p, size_t n,
+                     unsigned int ring)
+{
+    size_t step, accepted;
+
+    for (size_t i = 0; i < n; i += step) {
+        step = (n - i < PD3_ESTIMATOR_BATCH_SIZE) ? n - i : PD3_ESTIMATOR_BATCH_SIZE;
+        for (size_t j = 0; j < step; j += accepted) {
+            if (pd3_estimator_push_packet_infos(h, &p[i + j], step - j, &accepted) == 0
+                || !ring) {
+                break;
+            }
+            pd3_estimator_flush(h);
+        }
+        pd3_estimator_flush(h);
+    }
+}
+
+/* Packet infos for `streams` in-order streams, interleaved, stamped
+ * within the first period */
+static pd3_estimator_packet_info *make_packets(size_t n, unsigned int streams,
+                                               unsigned int first_stream)
+{
+    pd3_estimator_packet_info *p = calloc(n, sizeof(*p));
+
+    if (!p) {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        set_stream(&p[i].stream, first_stream + i % streams);
+        p[i].seq = 1 + i / streams;
+        p[i].timestamp = BENCH_CLOCK_START + 1 + (i * (BENCH_INTERVAL_US - 2)) / n;
+    }
+    return p;
+}
+
+/************************ Benchmarks *****************************/
+
+#define PUSH_PACKETS (1 << 20)
+
+struct pushArgs {
+    pd3_estimator_packet_info *packets;
+    size_t n;
+    unsigned int ring;
+    pthread_barrier_t *barrier;
+};
+
+static void *push_thread(void *arg)
+{
+    struct pushArgs *a = arg;
+    pd3_estimator_handle *h = pd3_estimator_create_handle();
+
+    pthread_barrier_wait(a->barrier);
+    if (h) {
+        push_all(h, a->packets, a->n, a->ring);
+        pd3_estimator_destroy_handle(h);
+    }
+    pthread_barrier_wait(a->barrier);
+    return NULL;
+}
+
+/* Client side cost of pushing and flushing, per packet, with several
+ * threads each pushing its own streams. With `ring`, each ring holds
+ * all of a thread's packets, so that pushes never wait for the
+ * aggregators to drain a full ring and the two transports compare. */
+static void bench_push_flush(const char *name, bool ring)
+{
+    static const unsigned int threads[] = { 1, 2, 4 };
+
+    for (unsigned int t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        unsigned int nt = threads[t];
+        unsigned int ring_size = ring ? PUSH_PACKETS / nt : 0;
+        struct benchRun r[runs];
+        struct pushArgs args[nt];
+        pthread_t tids[nt];
+        pthread_barrier_t barrier;
+        struct benchTimer timer;
+        char value[16];
+
+        for (unsigned int i = 0; i < runs; i++) {
+            memset(&r[i], 0, sizeof(r[i]));
+            if (pipeline_start(nt, ring_size) != 0) {
+                continue;
+            }
+            pthread_barrier_init(&barrier, NULL, nt + 1);
+            for (unsigned int k = 0; k < nt; k++) {
+                args[k].n = PUSH_PACKETS / nt;
+                args[k].packets = make_packets(args[k].n, 256, k * 256);
+                args[k].ring = ring_size;
+                args[k].barrier = &barrier;
+                pthread_create(&tids[k], NULL, push_thread, &args[k]);
+            }
+            pthread_barrier_wait(&barrier);
+            timer_start(&timer);
+            pthread_barrier_wait(&barrier);
+            timer_stop(&timer, &r[i], PUSH_PACKETS);
+            for (unsigned int k = 0; k < nt; k++) {
+                pthread_join(tids[k], NULL);
+                free(args[k].packets);
+            }
+            pthread_barrier_destroy(&barrier);
+            pd3_estimator_destroy();
+        }
+        snprintf(value, sizeof(value), "%u", nt);
+        emit(name, "threads", value, r, runs);
+    }
+}
+
+#define AGGREGATOR_PACKETS (1 << 20)
+
+/* Packets per second through push, aggregation and reporting, by
+ * number of aggregators: the time from the first push until the
+ * report of the period holding every packet */
+static void bench_aggregator(void)
+{
+    static const unsigned int aggregators[] = { 1, 2, 4 };
+    pd3_estimator_packet_info *packets = make_packets(AGGREGATOR_PACKETS, 1024, 0);
+
+    for (unsigned int a = 0; packets && a < sizeof(aggregators) / sizeof(aggregators[0]); a++) {
+        struct benchRun r[runs];
+        struct benchTimer timer;
+        pd3_estimator_handle *h;
+        char value[16];
+
+        for (unsigned int i = 0; i < runs; i++) {
+            memset(&r[i], 0, sizeof(r[i]));
+            if (pipeline_start(aggregators[a], 0) != 0 || !(h = pd3_estimator_create_handle())) {
+                continue;
+            }
+            timer_start(&timer);
+            push_all(h, packets, AGGREGATOR_PACKETS, 0);
+            pd3_estimator_advance_clock(BENCH_CLOCK_START + BENCH_INTERVAL_US);
+            if (wait_for(&delivered_packets, AGGREGATOR_PACKETS) == 0) {
+                timer_stop(&timer, &r[i], AGGREGATOR_PACKETS);
+            }
+            pd3_estimator_destroy_handle(h);
+            pd3_estimator_destroy();
+        }
+        snprintf(value, sizeof(value), "%u", aggregators[a]);
+        emit("aggregator", "aggregators", value, r, runs);
+    }
+    free(packets);
+}
+
+#define HASHMAP_LOOKUPS (1 << 21)
+
+/* Stream table insertion and lookup, by number of streams */
+static void bench_hashmap(void)
+{
+    static const unsigned int sizes[] = { 1000, 10000, 100000, 1000000 };
+    struct hashMapKey *keys = malloc(HASHMAP_LOOKUPS * sizeof(*keys));
+
+    for (unsigned int s = 0; keys && s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        unsigned int n = sizes[s];
+        struct benchRun insert[runs], lookup[runs];
+        struct benchTimer timer;
+        struct hashMapItemList freelist;
+        struct hashMapKey key;
+        struct hashMap hm;
+        stream_tuple st;
+        uint64_t seed = 88172645463325252ull;
+        char value[16];
+
+        /* Streams looked up in random order */
+        for (unsigned int i = 0; i < HASHMAP_LOOKUPS; i++) {
+            set_stream(&st, xorshift(&seed) % n);
+            set_streamtuple(&keys[i], &st);
+        }
+
+        for (unsigned int i = 0; i < runs; i++) {
+            memset(&hm, 0, sizeof(hm));
+            memset(&freelist, 0, sizeof(freelist));
+            freelist.role = HMI_STREAM;
+
+            timer_start(&timer);
+            for (unsigned int k = 0; k < n; k++) {
+                set_stream(&st, k);
+                set_streamtuple(&key, &st);
+                hashmap_force(&hm, &key, &freelist);
+            }
+            timer_stop(&timer, &insert[i], n);
+
+            timer_start(&timer);
+            for (unsigned int k = 0; k < HASHMAP_LOOKUPS; k++) {
+                key = keys[k];
+                hashmap_force(&hm, &key, &freelist);
+            }
+            timer_stop(&timer, &lookup[i], HASHMAP_LOOKUPS);
+
+            hashmap_item_list_destroy(&hm.items);
+            hashmap_free_table(&hm);
+        }
+        snprintf(value, sizeof(value), "%u", n);
+        emit("hashmap_insert", "streams", value, insert, runs);
+        emit("hashmap_lookup", "streams", value, lookup, runs);
+    }
+    free(keys);
+}
+
+#define A2R_PERIODS 16
+#define A2R_PERIOD_PACKETS 4096
+#define A2R_PASSES 16
+
+/* Loss conversion of one stream's period, by number of ranges of
+ * received sequence numbers per period */
+static void bench_loss_a2r(void)
+{
+    static const unsigned int ranges[] = { 1, 16, 64, 256, 1024 };
+
+    for (unsigned int g = 0; g < sizeof(ranges) / sizeof(ranges[0]); g++) {
+        struct hashMapItem *items[A2R_PERIODS];
+        struct hashMapItemList list;
+        struct seqnoRangeList free_ranges;
+        struct seqnoBitmapList free_bitmaps;
+        struct lossDataR ldr;
+        struct lossState lstate;
+        struct benchRun r[runs];
+        struct benchTimer timer;
+        unsigned int run_length = A2R_PERIOD_PACKETS / ranges[g];
+        SEQNO seq = 1;
+        char value[16];
+
+        /* Each period receives `ranges` runs of sequence numbers,
+         * each followed by a drop */
+        lossdata_init();
+        memset(&list, 0, sizeof(list));
+        memset(&free_ranges, 0, sizeof(free_ranges));
+        memset(&free_bitmaps, 0, sizeof(free_bitmaps));
+        for (unsigned int p = 0; p < A2R_PERIODS; p++) {
+            items[p] = add_hashmapitem(&list, NULL);
+            items[p]->value.agg_data.epoch = p;
+            if (p > 0) {
+                items[p - 1]->value.agg_data.next_period = items[p];
+            }
+            for (unsigned int k = 0; k < ranges[g]; k++, seq++) {
+                for (unsigned int j = 0; j < run_length; j++) {
+                    lossdata_arrival(&items[p]->value.agg_data.loss, seq++,
+                                     &free_ranges, &free_bitmaps);
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i < runs; i++) {
+            timer_start(&timer);
+            for (unsigned int pass = 0; pass < A2R_PASSES; pass++) {
+                memset(&lstate, 0, sizeof(lstate));
+                for (unsigned int p = 0; p < A2R_PERIODS; p++) {
+                    memset(&ldr, 0, sizeof(ldr));
+                    lossdata_a2r(&ldr, &items[p]->value.agg_data.loss, &lstate, items[p], 1);
+                }
+            }
+            timer_stop(&timer, &r[i], A2R_PASSES * A2R_PERIODS);
+        }
+        snprintf(value, sizeof(value), "%u", ranges[g]);
+        emit("loss_a2r", "ranges", value, r, runs);
+
+        hashmap_item_list_destroy(&list);
+        free_seqnorangelist(&free_ranges);
+        free_seqnobitmaplist(&free_bitmaps);
+    }
+}
+
+/* Arrival orders of the reorder benchmark */
+enum reorderPattern {
+    PATTERN_IN_ORDER,
+    PATTERN_ADJACENT_SWAPS,  /* one pair in ten swapped */
+    PATTERN_SHUFFLE_8,       /* shuffled within blocks of 8 */
+    PATTERN_SHUFFLE_64,      /* shuffled within blocks of 64 */
+    PATTERN_LATE_100,        /* one packet in 128 held back by 100 */
+    PATTERN_COUNT
+};
+
+static const char *pattern_names[PATTERN_COUNT] = {
+    "in_order", "adjacent_swaps", "shuffle_8", "shuffle_64", "late_100"
+};
+
+static void make_pattern(SEQNO *seqs, unsigned int n, SEQNO first, enum reorderPattern pattern,
+                         uint64_t *seed)
+{
+    unsigned int block = (pattern == PATTERN_SHUFFLE_8) ? 8 : 64;
+
+    for (unsigned int i = 0; i < n; i++) {
+        seqs[i] = first + i;
+    }
+    switch (pattern) {
+    case PATTERN_ADJACENT_SWAPS:
+        for (unsigned int i = 5; i < n; i += 10) {
+            SEQNO t = seqs[i - 1];
+            seqs[i - 1] = seqs[i];
+            seqs[i] = t;
+        }
+        break;
+    case PATTERN_SHUFFLE_8:
+    case PATTERN_SHUFFLE_64:
+        for (unsigned int b = 0; b + block <= n; b += block) {
+            for (unsigned int i = block - 1; i > 0; i--) {
+                unsigned int j = xorshift(seed) % (i + 1);
+                SEQNO t = seqs[b + i];
+                seqs[b + i] = seqs[b + j];
+                seqs[b + j] = t;
+            }
+        }
+        break;
+    case PATTERN_LATE_100:
+        for (unsigned int i = 0; i + 100 < n; i += 128) {
+            SEQNO late = seqs[i];
+            memmove(&seqs[i], &seqs[i + 1], 100 * sizeof(*seqs));
+            seqs[i + 100] = late;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Reorder conversion of one stream's period, per packet, by arrival
+ * order */
+static void bench_reorder_a2r(void)
+{
+    struct reorderDataA periods[A2R_PERIODS];
+    struct seqnoRangeList free_ranges;
+    struct reorderDataR *dr;
+    struct reorderState rstate;
+    SEQNO seqs[A2R_PERIOD_PACKETS];
+    uint64_t seed = 2463534242ull;
+
+    reorderdata_init(true, true, REORDER_MAX_EXTENT, REORDER_DT, 0);
+    dr = malloc(reorderdata_size());
+    if (!dr) {
+        return;
+    }
+    memset(&free_ranges, 0, sizeof(free_ranges));
+
+    for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+        struct benchRun r[runs];
+        struct benchTimer timer;
+        char value[32];
+
+        memset(periods, 0, sizeof(periods));
+        for (unsigned int p = 0; p < A2R_PERIODS; p++) {
+            make_pattern(seqs, A2R_PERIOD_PACKETS, 1 + p * A2R_PERIOD_PACKETS, pattern, &seed);
+            for (unsigned int k = 0; k < A2R_PERIOD_PACKETS; k++) {
+                reorderdata_arrival(&periods[p], seqs[k], &free_ranges);
+            }
+        }
+
+        for (unsigned int i = 0; i < runs; i++) {
+            timer_start(&timer);
+            for (unsigned int pass = 0; pass < A2R_PASSES; pass++) {
+                memset(&rstate, 0, sizeof(rstate));
+                for (unsigned int p = 0; p < A2R_PERIODS; p++) {
+                    memset(dr, 0, reorderdata_size());
+                    reorderdata_a2r(dr, &periods[p], &rstate);
+                }
+                reorderdata_destroy_state(&rstate);
+            }
+            timer_stop(&timer, &r[i], A2R_PASSES * A2R_PERIODS * A2R_PERIOD_PACKETS);
+        }
+        snprintf(value, sizeof(value), "\"%s\"", pattern_names[pattern]);
+        emit("reorder_a2r", "pattern", value, r, runs);
+
+        for (unsigned int p = 0; p < A2R_PERIODS; p++) {
+            free_seqnorangelist(&periods[p].ranges);
+        }
+    }
+    free_seqnorangelist(&free_ranges);
+    free(dr);
+}
+
+#define REPORT_STREAM_PACKETS 16
+
+/* Report generation, per flow: the time from the end of a period
+ * whose packets are all aggregated until its report is delivered */
+static void bench_report(void)
+{
+    static const unsigned int flows[] = { 100, 1000, 10000, 100000 };
+
+    for (unsigned int f = 0; f < sizeof(flows) / sizeof(flows[0]); f++) {
+        unsigned int n = flows[f];
+        size_t npackets;
+        pd3_estimator_packet_info *packets;
+        struct benchRun r[runs];
+        struct benchTimer timer;
+        pd3_estimator_handle *h;
+        char value[16];
+
+        /* One stream per flow, as far as the flow keys go */
+        if (PD3_ESTIMATOR_KEY_SIZE < sizeof(n) && n > 1u << (8 * PD3_ESTIMATOR_KEY_SIZE)) {
+            n = 1u << (8 * PD3_ESTIMATOR_KEY_SIZE);
+        }
+        npackets = (size_t) n * REPORT_STREAM_PACKETS;
+
+        packets = make_packets(npackets, n, 0);
+        if (!packets) {
+            continue;
+        }
+        for (unsigned int i = 0; i < runs; i++) {
+            memset(&r[i], 0, sizeof(r[i]));
+            if (pipeline_start(1, 0) != 0 || !(h = pd3_estimator_create_handle())) {
+                continue;
+            }
+            push_all(h, packets, npackets, 0);
+
+            /* Let the aggregator take everything in, then end the
+             * period */
+            usleep(200000);
+            timer_start(&timer);
+            pd3_estimator_advance_clock(BENCH_CLOCK_START + BENCH_INTERVAL_US);
+            if (wait_for(&delivered_flows, n) == 0) {
+                double ns = (delivered_at.tv_sec - timer.start.tv_sec) * 1e9
+                    + (delivered_at.tv_nsec - timer.start.tv_nsec);
+                r[i].ns = ns;
+                r[i].allocs = atomic_load(&delivered_allocs) - timer.allocs;
+                r[i].ops = n;
+            }
+            pd3_estimator_destroy_handle(h);
+            pd3_estimator_destroy();
+        }
+        free(packets);
+        snprintf(value, sizeof(value), "%u", n);
+        emit("report", "flows", value, r, runs);
+    }
+}
+
+static void bench_push_flush_queue(void)
+{
+    bench_push_flush("push_flush", false);
+}
+
+static void bench_push_flush_ring(void)
+{
+    bench_push_flush("push_flush_ring", true);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} benchmarks[] = {
+    { "push_flush", bench_push_flush_queue },
+    { "push_flush_ring", bench_push_flush_ring },
+    { "aggregator", bench_aggregator },
+    { "hashmap", bench_hashmap },
+    { "loss_a2r", bench_loss_a2r },
+    { "reorder_a2r", bench_reorder_a2r },
+    { "report", bench_report },
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-o file] [-r runs] [benchmark...]\n"
+            "  -o file  write the JSON results to file (default stdout)\n"
+            "  -r runs  runs per benchmark (default %d)\n"
+            "benchmarks:",
+            prog, BENCH_DEFAULT_RUNS);
+    for (unsigned int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        fprintf(stderr, " %s", benchmarks[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    out = stdout;
+    while ((opt = getopt(argc, argv, "o:r:")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = fopen(optarg, "w");
+            if (!out) {
+                perror(optarg);
+                return -1;
+            }
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            if (runs == 0) {
+                runs = 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    /* The library reports its progress on stdout */
+    if (out == stdout) {
+        out = fdopen(dup(STDOUT_FILENO), "w");
+    }
+    if (!out || !freopen("/dev/null", "w", stdout)) {
+        perror("stdout");
+        return -1;
+    }
+
+    fprintf(out, "{\"key_size\": %d, \"batch_size\": %d, \"benchmarks\": [",
+            PD3_ESTIMATOR_KEY_SIZE, PD3_ESTIMATOR_BATCH_SIZE);
+    for (unsigned int i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        int selected = (optind == argc);
+        for (int a = optind; a < argc; a++) {
+            selected |= (strcmp(argv[a], benchmarks[i].name) == 0);
+        }
+        if (selected) {
+            benchmarks[i].run();
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+
+    return 0;
+}
@@ -24,22 +24,106 @@
  */
 
 #include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <time.h>
-#include <sys/time.h>
 #include <unistd.h>
 #include "pd3_estimator.h"
+#include "capture.h"
+#include "crc.h"
 #include "fistq.h"
 #include "datatypes.h"
 #include "hashmap2.h"
+#include "pinfobatch.h"
 #include "reportschedule.h"
+#include "resultring.h"
+#include "snapshot.h"
+#include "spscring.h"
+#include "streamregistry.h"
+#include "timesource.h"
+#include "workerpool.h"
+
+/* Number of spent batches the aggregator collects before returning
+ * them to the shared pool */
+#define PINFOBATCH_RETURN_THRESHOLD 32
+
+/* How long the aggregator naps when it finds every ring empty */
+#define RING_IDLE_POLL_NS 50000
+
+/* How long the aggregator waits on an empty queue before checking
+ * whether the virtual clock moved */
+#define VIRTUAL_CLOCK_POLL_NS 1000000
+
+/* Each aggregator thread owns a disjoint shard of the streams, chosen
+ * by a hash of the stream tuple. A shard keeps its own free lists and
+ * its own handoff area, so aggregators never share anything but the
+ * batch pool; the reporter merges the shards' hashmaps period by
+ * period.
+ *
+ * Streams live in the shard's persistent stream table for as long as
+ * the library runs. A period's hashmap is just the list of items for
+ * the streams seen in that period; each item points back to its
+ * stream's entry, which remembers the current period's item, so no
+ * per-period table is built, cleared or searched. */
+struct aggregatorShard {
+    pthread_t tid;
+    char fistq_dst[48];                 /* FISTQ_DST and any shard index */
+
+    /* Aggregator objects */
+    struct hashMapList working_a;
+    struct seqnoRangeList free_lossranges_a;
+    struct seqnoBitmapList free_lossbitmaps_a;
+    struct seqnoRangeList free_reorderranges_a;
+    struct hashMapList free_hashmaps_a;
+    struct hashMapItemList free_hashmapitems_a;
+    struct pinfoBatchList free_batches_a;
+    struct hashMap streams;               /* persistent stream table */
+    struct hashMapItemList free_streamitems;
+    struct hashMapItem **slot_streams;    /* stream entries, by slot */
+    unsigned int slot_streams_size;
+    unsigned int period;                  /* bumped at each transition */
+    TIMESTAMP period_end;                 /* on the virtual clock */
+
+    /* Reporter objects */
+    struct hashMapList working_r;
+    struct hashMapList free_hashmaps_r;
+    struct hashMapItemList free_hashmapitems_r;
+    struct seqnoRangeList free_lossranges_r;
+    struct seqnoBitmapList free_lossbitmaps_r;
+    struct seqnoRangeList free_reorderranges_r;
+    unsigned int unlinked;                /* latest periods not yet linked */
+
+    /* Shared objects, protected by shared_mutex */
+    struct hashMapList working_sh;
+    struct hashMapList free_hashmaps_sh;
+    struct hashMapItemList free_hashmapitems_sh;
+    struct seqnoRangeList free_lossranges_sh;
+    struct seqnoBitmapList free_lossbitmaps_sh;
+    struct seqnoRangeList free_reorderranges_sh;
+
+    /* Rings registered by the client handles. Handles only take the
+     * lock to register and unregister; the aggregator takes it once
+     * per sweep over all rings. A ring whose handle is destroyed while
+     * the aggregator is polling is marked closed and destroyed by the
+     * aggregator once drained. */
+    pthread_mutex_t ring_mutex;
+    struct spscRing *rings;
+    int rings_polled;
+};
 
 /* Private definition of handle data structure */
 struct pd3_estimator_handle_s {
-    fistq_handle *handle;
+    fistq_handle **handles;             /* one per shard */
+    struct pinfoBatchList free_batches; /* storage remains in handle */
+    struct pinfoBatch **filling;        /* one per shard, sharded pushes only */
+    size_t *filling_from;               /* index in the pushed vector of each one's first */
+    struct spscRing **rings;            /* one per shard, ring transport only */
+    pd3_estimator_capture_record *capture; /* records not yet written, capture only */
+    unsigned int capture_count;
+    TIMESTAMP latest;                   /* latest packet time, virtual clock only */
 };
 
-/* fistq names */
+/* fistq names. Each shard appends its index to the destination. */
 static char *FISTQ_SRC = "pd3_estimator_client";
 static char *FISTQ_DST = "pd3_estimator_aggregator";
 
@@ -49,46 +133,69 @@ static int pd3_estimator_done = 0;
 
 /* Configuration */
 static struct timespec aggregator_interval;
+static TIMEINTERVAL aggregator_interval_us;
+static TIMESTAMP virtual_clock_start;
 static bool loss_enabled = true;
 static bool reorder_extent_enabled = true;
 static bool reorder_density_enabled = true;
+static unsigned int ring_size;
+static bool sparse_results;
 static pd3_estimator_callbacks callbacks;
+static struct snapshotStore *snapshots;   /* latest report, for queries */
+static struct resultRing *results_ring;   /* 'm' outlet */
+static struct captureFile *capture;       /* pushed packet infos, for replay */
 
 /* Thread synchronization */
 static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t shared_mutex;
 static pthread_cond_t shared_cond;
 
-/* Aggregator objects */
-static pthread_t aggregator_tid;
-static struct hashMapList working_a;
-static struct seqnoRangeList free_lossranges_a;
-static struct seqnoRangeList free_reorderranges_a;
-static struct hashMapList free_hashmaps_a;
-static struct hashMapItemList free_hashmapitems_a;
+/* Aggregator shards */
+static struct aggregatorShard *shards;
+static unsigned int num_shards;
 
 /* Reporter objects */
 static pthread_t reporter_tid;
 static unsigned int periods_to_wait;
 static int reporter_sleeping;
-static struct hashMapList working_r;
-static struct hashMapList free_hashmaps_r;
-static struct hashMapItemList free_hashmapitems_r;
-static struct seqnoRangeList free_lossranges_r;
-static struct seqnoRangeList free_reorderranges_r;
-static struct hashMapItemList free_hmis_local; /* storage remains in reporter */
+static unsigned int num_reporter_workers;
+static struct hashMapItemList free_hmis_tracker; /* storage remains in reporter */
 
 /* Shared objects */
 static char schedule[128];
-static struct hashMapList working_sh;
-static struct hashMapList free_hashmaps_sh;
-static struct hashMapItemList free_hashmapitems_sh;
-static struct seqnoRangeList free_lossranges_sh;
-static struct seqnoRangeList free_reorderranges_sh;
+
+/* Batch pool shared by the client handles and the aggregators. Clients
+ * take the whole pool at once when they run dry, so the lock is taken
+ * once per many vectors rather than once per vector. */
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pinfoBatchList free_batches_sh;
 
 /* Local declarations */
 static void *aggregator_thread(void *arg);
 static void *reporter_thread(void *arg);
+static int init_abort(pd3_estimator_options *options, unsigned int aggregators);
+
+/* Stable mapping from stream to the shard that aggregates it */
+static inline unsigned int shard_of(const stream_tuple *stream)
+{
+    if (num_shards == 1) {
+        return 0;
+    }
+    return crc_generate((unsigned char *) stream, sizeof(*stream)) % num_shards;
+}
+
+/* Shard for a pushed packet info. Returns -1 if it names a slot that
+ * was never registered. */
+static inline int shard_of_pinfo(const pd3_estimator_packet_info *pinfo)
+{
+    const struct streamSlot *ss;
+
+    if (!pinfo->slot) {
+        return shard_of(&pinfo->stream);
+    }
+    ss = streamregistry_get(pinfo->slot);
+    return ss ? (int) ss->shard : -1;
+}
 
 int pd3_estimator_init(pd3_estimator_options *options, pd3_estimator_callbacks *cbs)
 {
@@ -104,6 +211,17 @@ int pd3_estimator_init(pd3_estimator_options *options, pd3_estimator_callbacks *
         return -1;
     }
 
+    if (options->virtual_clock && options->aggregation_interval < 1e-6) {
+        fprintf(stderr, "Invalid options: the virtual clock needs an aggregation interval of at least 1us\n");
+        return -1;
+    }
+
+    if (options->reorder_extent_precision > REORDER_MAX_EXTENT_PRECISION) {
+        fprintf(stderr, "Invalid options: reorder extent precision must be at most %d\n",
+                REORDER_MAX_EXTENT_PRECISION);
+        return -1;
+    }
+
     /* Make sure we initialize at most once */
     pthread_mutex_lock(&init_mutex);
     if (pd3_estimator_started) {
@@ -128,20 +246,61 @@ int pd3_estimator_init(pd3_estimator_options *options, pd3_estimator_callbacks *
     agg_int = options->aggregation_interval;
     aggregator_interval.tv_sec = (time_t) floor(agg_int);
     aggregator_interval.tv_nsec = (long) ((agg_int - floor(agg_int)) * 1e9);
-    memset(&free_lossranges_a, 0, sizeof(free_lossranges_a));
-    memset(&free_reorderranges_a, 0, sizeof(free_reorderranges_a));
-    memset(&free_hashmaps_a, 0, sizeof(free_hashmaps_a));
-    memset(&free_hashmapitems_a, 0, sizeof(free_hashmapitems_a));
+    aggregator_interval_us = (TIMEINTERVAL) llround(agg_int * 1e6);
+    virtual_clock_start = options->virtual_clock_start;
+    timesource_init(options->virtual_clock, virtual_clock_start);
+    ring_size = options->ring_size;
+    sparse_results = options->sparse_results;
+    if (options->snapshot_flows > 0) {
+        snapshots = snapshot_create(options->snapshot_flows);
+        if (!snapshots) {
+            return init_abort(options, 0);
+        }
+    }
+    if (options->results_ring_path) {
+        results_ring = resultring_create(options->results_ring_path,
+                                         options->results_ring_size ? options->results_ring_size
+                                                                    : RESULTRING_DEFAULT_SIZE);
+        if (!results_ring) {
+            fprintf(stderr, "could not create results ring %s\n", options->results_ring_path);
+            return init_abort(options, 0);
+        }
+    }
+    if (options->capture_path) {
+        capture = capture_create(options->capture_path);
+        if (!capture) {
+            fprintf(stderr, "could not create capture file %s\n", options->capture_path);
+            return init_abort(options, 0);
+        }
+    }
+    num_shards = (options->num_aggregators > 0) ? options->num_aggregators : 1;
+    shards = calloc(num_shards, sizeof(*shards));
+    if (!shards) {
+        fprintf(stderr, "calloc failed\n");
+        return init_abort(options, 0);
+    }
+    for (unsigned int i = 0; i < num_shards; i++) {
+        snprintf(shards[i].fistq_dst, sizeof(shards[i].fistq_dst), "%s%u",
+                 FISTQ_DST, i);
+        pthread_mutex_init(&shards[i].ring_mutex, NULL);
+        shards[i].free_streamitems.role = HMI_STREAM;
+        shards[i].period_end = virtual_clock_start + aggregator_interval_us;
+    }
 
     /* Reporter variables */
     periods_to_wait = options->reporter_min_batches;
+    num_reporter_workers = (options->num_reporter_workers > 0) ? options->num_reporter_workers : 1;
     reporter_sleeping = 0;
 
     memset(schedule, 0, sizeof(schedule));
     strncpy(schedule, options->reporter_schedule, sizeof(schedule) - 1);
-    if (set_schedule(schedule) == -1) {
+    if (set_schedule(schedule, timesource_now()) == -1) {
         fprintf(stderr, "could not set schedule\n");
-        return -1;
+        return init_abort(options, 0);
+    }
+    if (schedule_has_outlet('m') && !results_ring) {
+        fprintf(stderr, "Invalid options: the 'm' outlet needs a results_ring_path\n");
+        return init_abort(options, 0);
     }
 
     /* Initialize each estimator */
@@ -154,21 +313,24 @@ int pd3_estimator_init(pd3_estimator_options *options, pd3_estimator_callbacks *
     }
     if (reorder_extent_enabled || reorder_density_enabled) {
         fprintf(stdout, "Initializing reorder estimator...\n");
-        reorderdata_init(reorder_extent_enabled, reorder_density_enabled);
+        reorderdata_init(reorder_extent_enabled, reorder_density_enabled,
+                         options->reorder_max_extent ? options->reorder_max_extent : REORDER_MAX_EXTENT,
+                         options->reorder_dt ? options->reorder_dt : REORDER_DT,
+                         options->reorder_extent_precision);
     }
 
-    /* Create the aggregator thread */
-    if (pthread_create(&aggregator_tid, NULL, aggregator_thread, NULL) != 0) {
-        perror("pthread");
-        pthread_mutex_unlock(&init_mutex);
-        return -1;
+    /* Create the aggregator threads */
+    for (unsigned int i = 0; i < num_shards; i++) {
+        if (pthread_create(&shards[i].tid, NULL, aggregator_thread, &shards[i]) != 0) {
+            perror("pthread");
+            return init_abort(options, i);
+        }
     }
 
     /* Create the reporter thread */
     if (pthread_create(&reporter_tid, NULL, reporter_thread, NULL) != 0) {
         perror("pthread");
-        pthread_mutex_unlock(&init_mutex);
-        return -1;
+        return init_abort(options, num_shards);
     }
 
     pd3_estimator_started = 1;
@@ -177,49 +339,426 @@ int pd3_estimator_init(pd3_estimator_options *options, pd3_estimator_callbacks *
     return 0;
 }
 
+int pd3_estimator_query(const uint8_t *flow_key, pd3_estimator_results *results)
+{
+    if (!snapshots || !flow_key || !results) {
+        return -1;
+    }
+    return snapshot_query(snapshots, flow_key, results);
+}
+
+/* Unlinks and destroys a ring. Called with the shard's ring_mutex
+ * held. */
+static void unregister_ring_unsafe(struct aggregatorShard *shard,
+                                   struct spscRing *r)
+{
+    struct spscRing **p;
+
+    for (p = &shard->rings; *p; p = &(*p)->next) {
+        if (*p == r) {
+            *p = r->next;
+            break;
+        }
+    }
+    spscring_destroy(r);
+}
+
+static void release_ring(struct aggregatorShard *shard, struct spscRing *r)
+{
+    /* Publish what was pushed since the last flush, and let the
+     * aggregator consume it */
+    spscring_publish(r);
+    pthread_mutex_lock(&shard->ring_mutex);
+    if (shard->rings_polled) {
+        atomic_store_explicit(&r->closed, 1, memory_order_release);
+    } else {
+        unregister_ring_unsafe(shard, r);
+    }
+    pthread_mutex_unlock(&shard->ring_mutex);
+}
+
 pd3_estimator_handle *pd3_estimator_create_handle()
 {
     pd3_estimator_handle *h;
 
-    h = malloc(sizeof(*h));
+    h = calloc(1, sizeof(*h));
     if (!h) {
-        fprintf(stderr, "malloc failed\n");
+        fprintf(stderr, "calloc failed\n");
         return NULL;
     }
 
-    h->handle = fistq_getHandle(FISTQ_SRC, FISTQ_DST, FISTQ_FREE, NULL);
-    if (!h->handle) {
-        fprintf(stderr, "Could not create handle\n");
+    if (capture) {
+        h->capture = malloc(CAPTURE_BUFFER_RECORDS * sizeof(*h->capture));
+        if (!h->capture) {
+            fprintf(stderr, "malloc failed\n");
+            free(h);
+            return NULL;
+        }
+    }
+
+    if (ring_size) {
+        h->rings = calloc(num_shards, sizeof(*h->rings));
+        if (!h->rings) {
+            fprintf(stderr, "calloc failed\n");
+            pd3_estimator_destroy_handle(h);
+            return NULL;
+        }
+        for (unsigned int i = 0; i < num_shards; i++) {
+            h->rings[i] = spscring_create(ring_size);
+            if (!h->rings[i]) {
+                pd3_estimator_destroy_handle(h);
+                return NULL;
+            }
+            pthread_mutex_lock(&shards[i].ring_mutex);
+            h->rings[i]->next = shards[i].rings;
+            shards[i].rings = h->rings[i];
+            pthread_mutex_unlock(&shards[i].ring_mutex);
+        }
+        return h;
+    }
+
+    h->handles = calloc(num_shards, sizeof(*h->handles));
+    h->filling = calloc(num_shards, sizeof(*h->filling));
+    h->filling_from = calloc(num_shards, sizeof(*h->filling_from));
+    if (!h->handles || !h->filling || !h->filling_from) {
+        fprintf(stderr, "calloc failed\n");
+        pd3_estimator_destroy_handle(h);
         return NULL;
     }
+    for (unsigned int i = 0; i < num_shards; i++) {
+        h->handles[i] = fistq_getHandle(FISTQ_SRC, shards[i].fistq_dst, FISTQ_FREE, NULL);
+        if (!h->handles[i]) {
+            fprintf(stderr, "Could not create handle\n");
+            pd3_estimator_destroy_handle(h);
+            return NULL;
+        }
+    }
 
     return h;
 }
 
+int pd3_estimator_register_stream(pd3_estimator_handle *handle,
+                                  const stream_tuple *stream)
+{
+    if (!handle || !stream) {
+        fprintf(stderr, "NULL handle or stream\n");
+        return -1;
+    }
+
+    return streamregistry_add(stream, shard_of(stream));
+}
+
+/* Appends the handle's captured records to the capture file */
+static void capture_flush(pd3_estimator_handle *handle)
+{
+    if (handle->capture_count > 0) {
+        capture_write(capture, handle->capture, handle->capture_count);
+        handle->capture_count = 0;
+    }
+}
+
+/* Records packet infos accepted from a handle, stamping those without
+ * a timestamp with the current time */
+static void capture_pinfos(pd3_estimator_handle *handle,
+                           const pd3_estimator_packet_info *pinfos, size_t n)
+{
+    pd3_estimator_capture_record *rec;
+    const struct streamSlot *slot;
+    TIMESTAMP now = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        rec = &handle->capture[handle->capture_count];
+        memset(rec, 0, sizeof(*rec));
+        rec->timestamp = pinfos[i].timestamp;
+        if (rec->timestamp == 0) {
+            if (now == 0) {
+                now = timesource_now();
+            }
+            rec->timestamp = now;
+        }
+        rec->seq = pinfos[i].seq;
+        if (pinfos[i].slot) {
+            slot = streamregistry_get(pinfos[i].slot);
+            if (!slot) {
+                continue;
+            }
+            rec->stream = slot->stream;
+        }
+        else {
+            rec->stream = pinfos[i].stream;
+        }
+        if (++handle->capture_count == CAPTURE_BUFFER_RECORDS) {
+            capture_flush(handle);
+        }
+    }
+}
+
+/* Tracks the latest packet time pushed through a handle, by which
+ * flushing the handle advances the virtual clock */
+static inline void note_times(pd3_estimator_handle *handle,
+                              const pd3_estimator_packet_info *pinfos, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (pinfos[i].timestamp > handle->latest) {
+            handle->latest = pinfos[i].timestamp;
+        }
+    }
+}
+
 int pd3_estimator_push_packet_info(pd3_estimator_handle *handle,
                                    pd3_estimator_packet_info *pinfo)
 {
     pd3_estimator_packet_info *p;
+    int shard, ret;
 
     if (!handle) {
         fprintf(stderr, "NULL handle\n");
         return -1;
     }
 
-    /* FIXME: Consider using a pool of pinfos to avoid malloc */
-    p = malloc(sizeof(*p));
-    if (!p) {
-        fprintf(stderr, "malloc failed\n");
+    shard = shard_of_pinfo(pinfo);
+    if (shard < 0) {
+        fprintf(stderr, "Unregistered slot %u\n", pinfo->slot);
+        return -1;
+    }
+
+    if (handle->rings) {
+        ret = spscring_push(handle->rings[shard], pinfo);
+    }
+    else {
+        /* FIXME: Consider using a pool of pinfos to avoid malloc */
+        p = malloc(sizeof(*p));
+        if (!p) {
+            fprintf(stderr, "malloc failed\n");
+            return -1;
+        }
+        memcpy(p, pinfo, sizeof(*p));
+
+        ret = fistq_enqueue_any(handle->handles[shard], p, FISTQ_TYPE_PINFO, FISTQ_NOFLUSH);
+    }
+
+    if (ret == 0 && timesource_virtual()) {
+        note_times(handle, pinfo, 1);
+    }
+    if (ret == 0 && handle->capture) {
+        capture_pinfos(handle, pinfo, 1);
+    }
+    return ret;
+}
+
+/* Returns an empty batch from the handle's private pool, refilling the
+ * pool from the shared pool first if need be */
+static struct pinfoBatch *handle_get_batch(pd3_estimator_handle *handle)
+{
+    if (!handle->free_batches.head) {
+        pthread_mutex_lock(&batch_mutex);
+        move_pinfobatchlist(&handle->free_batches, &free_batches_sh);
+        pthread_mutex_unlock(&batch_mutex);
+    }
+
+    return get_pinfobatch(&handle->free_batches);
+}
+
+/* Appends a batch to the handle's local queue for the shard. The
+ * aggregator sees it only once the handle is flushed. */
+static int handle_enqueue_batch(pd3_estimator_handle *handle,
+                                unsigned int shard, struct pinfoBatch *b)
+{
+    return fistq_enqueue_any(handle->handles[shard], b, FISTQ_TYPE_PINFO_BATCH,
+                             FISTQ_NOFLUSH);
+}
+
+/* Takes the packet infos from `from` up to `to` back out of the
+ * batches of the push. Each shard's batches are chained from its
+ * newest, handle->filling[shard], and none has been flushed yet. */
+static void unfill_batches(pd3_estimator_handle *handle,
+                           const pd3_estimator_packet_info *pinfos,
+                           size_t from, size_t to)
+{
+    struct pinfoBatch *b;
+
+    while (to-- > from) {
+        b = handle->filling[shard_of_pinfo(&pinfos[to])];
+        while (b->count == 0) {
+            b = b->next;
+        }
+        b->count--;
+    }
+}
+
+/* Routes each packet info to its shard's batch, stopping at the first
+ * one that cannot be pushed. A full batch is enqueued once its shard
+ * needs another, and the newest batch of each shard when routing is
+ * done, so nothing lingers in the handle between calls. When a batch
+ * fails to enqueue, the push is cut back to its first packet info, so
+ * that `*accepted` counts exactly the packet infos pushed. */
+static int push_packet_infos_sharded(pd3_estimator_handle *handle,
+                                     const pd3_estimator_packet_info *pinfos,
+                                     size_t n, size_t *accepted)
+{
+    struct pinfoBatch *b;
+    int shard, failed = -1;
+    int last = num_shards;      /* first shard whose newest batch failed */
+    int ret = 0;
+    size_t i, end;
+
+    for (i = 0; i < n; i++) {
+        shard = shard_of_pinfo(&pinfos[i]);
+        if (shard < 0) {
+            ret = -1;
+            break;
+        }
+        b = handle->filling[shard];
+        if (!b || b->count == PD3_ESTIMATOR_BATCH_SIZE) {
+            b = handle_get_batch(handle);
+            if (!b) {
+                ret = -1;
+                break;
+            }
+            if (handle->filling[shard] &&
+                handle_enqueue_batch(handle, shard, handle->filling[shard]) != 0) {
+                put_pinfobatch(&handle->free_batches, b);
+                failed = shard;
+                ret = -1;
+                break;
+            }
+            b->next = handle->filling[shard];
+            handle->filling[shard] = b;
+            handle->filling_from[shard] = i;
+        }
+        b->pinfo[b->count++] = pinfos[i];
+    }
+
+    /* Enqueue the newest batches, up to the first that fails */
+    end = i;
+    for (shard = 0; shard < (int) num_shards; shard++) {
+        if (!handle->filling[shard]) {
+            continue;
+        }
+        if (shard != failed && last == (int) num_shards &&
+            handle_enqueue_batch(handle, shard, handle->filling[shard]) != 0) {
+            last = shard;
+            ret = -1;
+        }
+        if ((shard == failed || shard >= last) && handle->filling_from[shard] < end) {
+            end = handle->filling_from[shard];
+        }
+    }
+
+    /* Take back what follows a batch that was not enqueued, then drop
+     * the batches that were not enqueued, which that emptied */
+    unfill_batches(handle, pinfos, end, i);
+    for (shard = 0; shard < (int) num_shards; shard++) {
+        b = handle->filling[shard];
+        if (b && (shard == failed || shard >= last)) {
+            put_pinfobatch(&handle->free_batches, b);
+        }
+        handle->filling[shard] = NULL;
+    }
+
+    if (handle->capture) {
+        capture_pinfos(handle, pinfos, end);
+    }
+    *accepted = end;
+    return ret;
+}
+
+int pd3_estimator_push_packet_infos(pd3_estimator_handle *handle,
+                                    const pd3_estimator_packet_info *pinfos,
+                                    size_t n, size_t *accepted)
+{
+    struct pinfoBatch *b;
+    size_t count, done = 0, ignored;
+    int ret = 0;
+
+    if (!accepted) {
+        accepted = &ignored;
+    }
+    *accepted = 0;
+    if (!handle) {
+        fprintf(stderr, "NULL handle\n");
         return -1;
     }
-    memcpy(p, pinfo, sizeof(*p));
 
-    return fistq_enqueue_any(handle->handle, p, FISTQ_TYPE_PINFO, FISTQ_NOFLUSH);
+    if (handle->rings) {
+        for (done = 0; done < n; done++) {
+            int shard = shard_of_pinfo(&pinfos[done]);
+            if (shard < 0 || spscring_push(handle->rings[shard], &pinfos[done]) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+        if (handle->capture) {
+            capture_pinfos(handle, pinfos, done);
+        }
+        *accepted = done;
+    }
+    else if (num_shards > 1) {
+        ret = push_packet_infos_sharded(handle, pinfos, n, accepted);
+    }
+    else {
+        while (done < n) {
+            b = handle_get_batch(handle);
+            if (!b) {
+                ret = -1;
+                break;
+            }
+            count = (n - done < PD3_ESTIMATOR_BATCH_SIZE) ? n - done : PD3_ESTIMATOR_BATCH_SIZE;
+            b->count = count;
+            memcpy(b->pinfo, pinfos + done, count * sizeof(*pinfos));
+
+            if (handle_enqueue_batch(handle, 0, b) != 0) {
+                put_pinfobatch(&handle->free_batches, b);
+                ret = -1;
+                break;
+            }
+            if (handle->capture) {
+                capture_pinfos(handle, pinfos + done, count);
+            }
+            done += count;
+        }
+        *accepted = done;
+    }
+
+    /* Only what was pushed may move the virtual clock */
+    if (timesource_virtual()) {
+        note_times(handle, pinfos, *accepted);
+    }
+    return ret;
 }
 
 int pd3_estimator_flush(pd3_estimator_handle *handle)
 {
-    return fistq_flush(handle->handle);
+    int ret = 0;
+
+    if (handle->capture) {
+        capture_flush(handle);
+    }
+
+    for (unsigned int i = 0; i < num_shards; i++) {
+        if (handle->rings) {
+            spscring_publish(handle->rings[i]);
+        } else if (fistq_flush(handle->handles[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    /* The packets flushed are visible to the aggregators by now */
+    if (timesource_virtual()) {
+        timesource_advance(handle->latest);
+    }
+
+    return ret;
+}
+
+int pd3_estimator_advance_clock(TIMESTAMP now)
+{
+    if (!timesource_virtual()) {
+        fprintf(stderr, "The virtual clock is not in use\n");
+        return -1;
+    }
+    timesource_advance(now);
+    return 0;
 }
 
 int pd3_estimator_destroy_handle(pd3_estimator_handle *handle)
@@ -228,89 +767,185 @@ int pd3_estimator_destroy_handle(pd3_estimator_handle *handle)
         return -1;
     }
 
-    fistq_destroyHandle(handle->handle);
+    if (handle->capture) {
+        capture_flush(handle);
+        free(handle->capture);
+    }
+
+    if (handle->rings) {
+        for (unsigned int i = 0; i < num_shards; i++) {
+            if (handle->rings[i]) {
+                release_ring(&shards[i], handle->rings[i]);
+            }
+        }
+        free(handle->rings);
+        free(handle);
+        return 0;
+    }
+
+    if (handle->handles) {
+        for (unsigned int i = 0; i < num_shards; i++) {
+            if (handle->handles[i]) {
+                fistq_destroyHandle(handle->handles[i]);
+            }
+        }
+    }
+
+    /* Return the handle's unused batches to the shared pool */
+    pthread_mutex_lock(&batch_mutex);
+    move_pinfobatchlist(&free_batches_sh, &handle->free_batches);
+    pthread_mutex_unlock(&batch_mutex);
+
+    free(handle->handles);
+    free(handle->filling);
+    free(handle->filling_from);
     free(handle);
 
     return 0;
 }
 
-int pd3_estimator_destroy()
+static void shard_destroy(struct aggregatorShard *s)
 {
-    pthread_mutex_lock(&init_mutex);
-    if (!pd3_estimator_started) {
-        pthread_mutex_unlock(&init_mutex);
-        return 0;
-    }
+    /* Clean up sequence number ranges */
+    free_seqnorangelist(&s->free_lossranges_a);
+    free_seqnorangelist(&s->free_lossranges_r);
+    free_seqnorangelist(&s->free_lossranges_sh);
+    free_seqnorangelist(&s->free_reorderranges_a);
+    free_seqnorangelist(&s->free_reorderranges_r);
+    free_seqnorangelist(&s->free_reorderranges_sh);
+    free_seqnobitmaplist(&s->free_lossbitmaps_a);
+    free_seqnobitmaplist(&s->free_lossbitmaps_r);
+    free_seqnobitmaplist(&s->free_lossbitmaps_sh);
+
+    /* Clean up packet info batches */
+    free_pinfobatchlist(&s->free_batches_a);
+    free(s->slot_streams);
 
-    pthread_mutex_unlock(&init_mutex);
+    /* Clean up the free lists */
+    hashmap_item_list_destroy(&s->free_hashmapitems_a);
+    hashmap_item_list_destroy(&s->free_hashmapitems_r);
+    hashmap_item_list_destroy(&s->free_hashmapitems_sh);
+
+    hashmap_list_destroy(&s->free_hashmaps_a);
+    hashmap_list_destroy(&s->free_hashmaps_r);
+    hashmap_list_destroy(&s->free_hashmaps_sh);
+
+    /* Clean up working storage */
+    hashmap_list_destroy(&s->working_a);
+    hashmap_list_destroy(&s->working_r);
+    hashmap_list_destroy(&s->working_sh);
+
+    /* Clean up the streams */
+    hashmap_item_list_destroy(&s->streams.items);
+    hashmap_free_table(&s->streams);
+
+    pthread_mutex_destroy(&s->ring_mutex);
+}
 
+/* Stops the first `aggregators` aggregator threads, and the reporter
+ * thread if `reporter` is set. Returns 0 on success, -1 on error. */
+static int stop_threads(unsigned int aggregators, bool reporter)
+{
     /* Tell the threads we're done */
     pd3_estimator_done = 1;
 
-    if (pthread_join(aggregator_tid, NULL) != 0) {
-        perror("pthread_join");
-        return -1;
+    for (unsigned int i = 0; i < aggregators; i++) {
+        if (pthread_join(shards[i].tid, NULL) != 0) {
+            perror("pthread_join");
+            return -1;
+        }
     }
 
-    pthread_mutex_lock(&shared_mutex);
-    pthread_cond_signal(&shared_cond);
-    pthread_mutex_unlock(&shared_mutex);
+    if (reporter) {
+        pthread_mutex_lock(&shared_mutex);
+        pthread_cond_signal(&shared_cond);
+        pthread_mutex_unlock(&shared_mutex);
 
-    if (pthread_join(reporter_tid, NULL) != 0) {
-        perror("pthread_join");
-        return -1;
+        if (pthread_join(reporter_tid, NULL) != 0) {
+            perror("pthread_join");
+            return -1;
+        }
     }
 
-    /* Clean up sequence number ranges */
-    free_seqnorangelist(&free_lossranges_a);
-    free_seqnorangelist(&free_lossranges_r);
-    free_seqnorangelist(&free_lossranges_sh);
-    free_seqnorangelist(&free_reorderranges_a);
-    free_seqnorangelist(&free_reorderranges_r);
-    free_seqnorangelist(&free_reorderranges_sh);
-
-    memset(&free_lossranges_a, 0, sizeof(free_lossranges_a));
-    memset(&free_lossranges_r, 0, sizeof(free_lossranges_r));
-    memset(&free_lossranges_sh, 0, sizeof(free_lossranges_sh));
-    memset(&free_reorderranges_a, 0, sizeof(free_reorderranges_a));
-    memset(&free_reorderranges_r, 0, sizeof(free_reorderranges_r));
-    memset(&free_reorderranges_sh, 0, sizeof(free_reorderranges_sh));
+    return 0;
+}
 
-    /* Clean up the free lists */
-    hashmap_item_list_destroy(&free_hmis_local);
-    hashmap_item_list_destroy(&free_hashmapitems_a);
-    hashmap_item_list_destroy(&free_hashmapitems_r);
-    hashmap_item_list_destroy(&free_hashmapitems_sh);
-    memset(&free_hmis_local, 0, sizeof(free_hmis_local));
-    memset(&free_hashmapitems_a, 0, sizeof(free_hashmapitems_a));
-    memset(&free_hashmapitems_r, 0, sizeof(free_hashmapitems_r));
-    memset(&free_hashmapitems_sh, 0, sizeof(free_hashmapitems_sh));
-
-    hashmap_list_destroy(&free_hashmaps_a);
-    hashmap_list_destroy(&free_hashmaps_r);
-    hashmap_list_destroy(&free_hashmaps_sh);
-    memset(&free_hashmaps_a, 0, sizeof(free_hashmaps_a));
-    memset(&free_hashmaps_r, 0, sizeof(free_hashmaps_r));
-    memset(&free_hashmaps_sh, 0, sizeof(free_hashmaps_sh));
+/* Releases what pd3_estimator_init() set up, in reverse order, once
+ * the threads are stopped. Also undoes a partial initialization. */
+static void release_state(void)
+{
+    destroy_schedule();
 
-    /* Clean up working storage */
-    hashmap_list_destroy(&working_a);
-    hashmap_list_destroy(&working_r);
-    hashmap_list_destroy(&working_sh);
-    memset(&working_a, 0, sizeof(working_a));
-    memset(&working_r, 0, sizeof(working_r));
-    memset(&working_sh, 0, sizeof(working_sh));
+    /* Clean up the per-shard storage */
+    if (shards) {
+        for (unsigned int i = 0; i < num_shards; i++) {
+            shard_destroy(&shards[i]);
+        }
+        free(shards);
+        shards = NULL;
+    }
+    num_shards = 0;
+    streamregistry_destroy();
+
+    /* Clean up packet info batches */
+    pthread_mutex_lock(&batch_mutex);
+    free_pinfobatchlist(&free_batches_sh);
+    pthread_mutex_unlock(&batch_mutex);
+
+    /* Clean up the reporter's free list */
+    hashmap_item_list_destroy(&free_hmis_tracker);
+    memset(&free_hmis_tracker, 0, sizeof(free_hmis_tracker));
+
+    capture_destroy(capture);
+    capture = NULL;
+    resultring_destroy(results_ring);
+    results_ring = NULL;
+    snapshot_destroy(snapshots);
+    snapshots = NULL;
 
     pthread_mutex_destroy(&shared_mutex);
     pthread_cond_destroy(&shared_cond);
 
-    destroy_schedule();
-    lossdata_destroy_a2r_compute_array();
-
     /* Go back to our original state. The init_mutex remainds
      * statically initialized. */
-    pd3_estimator_started = 0;
     pd3_estimator_done = 0;
+}
+
+/* Undoes a failed pd3_estimator_init() that had started `aggregators`
+ * aggregator threads, and removes the files it created. Returns -1. */
+static int init_abort(pd3_estimator_options *options, unsigned int aggregators)
+{
+    bool ring_created = (results_ring != NULL);
+    bool capture_created = (capture != NULL);
+
+    stop_threads(aggregators, false);
+    release_state();
+    if (ring_created) {
+        unlink(options->results_ring_path);
+    }
+    if (capture_created) {
+        unlink(options->capture_path);
+    }
+    pthread_mutex_unlock(&init_mutex);
+
+    return -1;
+}
+
+int pd3_estimator_destroy()
+{
+    pthread_mutex_lock(&init_mutex);
+    if (!pd3_estimator_started) {
+        pthread_mutex_unlock(&init_mutex);
+        return 0;
+    }
+
+    pthread_mutex_unlock(&init_mutex);
+
+    if (stop_threads(num_shards, true) != 0) {
+        return -1;
+    }
+    release_state();
+    pd3_estimator_started = 0;
 
     return 0;
 }
@@ -343,82 +978,272 @@ static inline int timeCmp(struct timespec *lhs, struct timespec *rhs)
     return 0;
 }
 
-static void data_exchange_aggregator_unsafe()
+static void data_exchange_aggregator_unsafe(struct aggregatorShard *s)
 {
     /* move earliest working hashmap into shared area */
-    moveone_hashmap(&working_sh, &working_a);
+    moveone_hashmap(&s->working_sh, &s->working_a);
 
     /* move freelists into aggregator */
-    moveall_hashmap(&free_hashmaps_a, &free_hashmaps_sh);
-    move_hmilist(&free_hashmapitems_a, &free_hashmapitems_sh);
-    move_seqnorangelist(&free_lossranges_a, &free_lossranges_sh);
-    move_seqnorangelist(&free_reorderranges_a, &free_reorderranges_sh);
+    moveall_hashmap(&s->free_hashmaps_a, &s->free_hashmaps_sh);
+    move_hmilist(&s->free_hashmapitems_a, &s->free_hashmapitems_sh);
+    move_seqnorangelist(&s->free_lossranges_a, &s->free_lossranges_sh);
+    move_seqnobitmaplist(&s->free_lossbitmaps_a, &s->free_lossbitmaps_sh);
+    move_seqnorangelist(&s->free_reorderranges_a, &s->free_reorderranges_sh);
 }
 
-/* Invoked by the aggregator thread */
-static void period_transition()
+/* Invoked by an aggregator thread */
+static void return_batches(struct aggregatorShard *s)
+{
+    pthread_mutex_lock(&batch_mutex);
+    move_pinfobatchlist(&free_batches_sh, &s->free_batches_a);
+    pthread_mutex_unlock(&batch_mutex);
+}
+
+/* Invoked by an aggregator thread */
+static void period_transition(struct aggregatorShard *s)
 {
     pthread_mutex_lock(&shared_mutex);
 
-    data_exchange_aggregator_unsafe();
+    data_exchange_aggregator_unsafe(s);
     if (reporter_sleeping) {
         pthread_cond_signal(&shared_cond);
     }
     pthread_mutex_unlock(&shared_mutex);
 
-    add_hashmap(&working_a, &free_hashmaps_a);
+    add_hashmap(&s->working_a, &s->free_hashmaps_a);
+    s->working_a.latest->epoch = ++s->period;
+
+    if (s->free_batches_a.head) {
+        return_batches(s);
+    }
+}
+
+/* Starts the periods that end, on the virtual clock, at or before
+ * `t`. Periods that saw no packet are handed over empty, so that all
+ * shards agree on the period boundaries. */
+static void virtual_transitions(struct aggregatorShard *s, TIMESTAMP t)
+{
+    while (t >= s->period_end) {
+        period_transition(s);
+        s->period_end += aggregator_interval_us;
+    }
 }
 
-static void handle_packet_arrival(void *data)
+/* Finds the stream entry for a registered stream, hashing the stream
+ * only on its first packet. Returns NULL if the slot was never
+ * registered. */
+static struct hashMapItem *lookup_slot(struct aggregatorShard *s, uint32_t slot)
 {
-    pd3_estimator_packet_info *ppi;
+    const struct streamSlot *ss;
+    struct hashMapItem **e;
     struct hashMapKey key;
+
+    if (slot >= s->slot_streams_size) {
+        unsigned int size = s->slot_streams_size ? s->slot_streams_size : 1024;
+        while (size <= slot) {
+            size *= 2;
+        }
+        e = realloc(s->slot_streams, size * sizeof(*e));
+        if (!e) {
+            fprintf(stderr, "realloc failed\n");
+            return NULL;
+        }
+        memset(e + s->slot_streams_size, 0,
+               (size - s->slot_streams_size) * sizeof(*e));
+        s->slot_streams = e;
+        s->slot_streams_size = size;
+    }
+
+    e = &s->slot_streams[slot];
+    if (!*e) {
+        ss = streamregistry_get(slot);
+        if (!ss) {
+            return NULL;
+        }
+        set_streamtuple(&key, (stream_tuple *) &ss->stream);
+        *e = hashmap_force(&s->streams, &key, &s->free_streamitems);
+    }
+
+    return *e;
+}
+
+/* Returns the stream's item in the current period, starting one if
+ * this is the stream's first packet of the period */
+static struct hashMapItem *current_item(struct aggregatorShard *s,
+                                        struct hashMapItem *stream)
+{
+    struct streamData *sd = &stream->value.stream_data;
     struct hashMapItem *hmi;
+
+    if (sd->current && sd->current_epoch == s->period) {
+        return sd->current;
+    }
+
+    hmi = add_hashmapitem(&s->working_a.latest->items, &s->free_hashmapitems_a);
+    if (!hmi) {
+        return NULL;
+    }
+    keycpy(&hmi->key, &stream->key);
+    hmi->value.agg_data.stream = stream;
+    hmi->value.agg_data.epoch = s->period;
+    sd->current = hmi;
+    sd->current_epoch = s->period;
+
+    return hmi;
+}
+
+static void handle_packet_arrival(void *arg, pd3_estimator_packet_info *ppi)
+{
+    struct aggregatorShard *s = arg;
+    struct hashMapKey key;
+    struct hashMapItem *stream, *hmi;
     struct aggregatorData *ad;
     struct packetData *pd;
 
-    ppi = data;
+    /* Get timestamp of this packet arrival, unless the caller
+     * supplied one */
+    TIMESTAMP ts = ppi->timestamp;
+    if (ts == 0) {
+        ts = timesource_now();
+    }
+
+    /* On the virtual clock, the packet's own time places it in a
+     * period */
+    if (timesource_virtual()) {
+        virtual_transitions(s, ts);
+    }
 
     /* Look up the hash map item for this stream */
-    set_streamtuple(&key, &ppi->stream);
-    hmi = hashmap_force(working_a.latest, &key, &free_hashmapitems_a);
+    if (ppi->slot) {
+        stream = lookup_slot(s, ppi->slot);
+    } else {
+        set_streamtuple(&key, &ppi->stream);
+        stream = hashmap_force(&s->streams, &key, &s->free_streamitems);
+    }
+    if (!stream || !(hmi = current_item(s, stream))) {
+        return;
+    }
     ad = &hmi->value.agg_data;
     pd = &ad->received;
 
-    /* Get timestamp of this packet arrival */
-    struct timeval now;
-    TIMESTAMP ts;
-    gettimeofday(&now, NULL);
-    ts = (now.tv_sec * 1e6) + now.tv_usec;
-
     /* Tell relevant parties about the new packet */
     packetdata_arrival(pd, ts, ppi->seq);
 
     if (loss_enabled) {
-        lossdata_arrival(&ad->loss, ppi->seq, &free_lossranges_a);
+        lossdata_arrival(&ad->loss, ppi->seq, &s->free_lossranges_a,
+                         &s->free_lossbitmaps_a);
     }
     if (reorder_extent_enabled || reorder_density_enabled) {
-        reorderdata_arrival(&ad->reorder, ppi->seq, &free_reorderranges_a);
+        reorderdata_arrival(&ad->reorder, ppi->seq, &s->free_reorderranges_a);
+    }
+}
+
+/* Consumes everything published on the shard's rings. Returns the
+ * number of packets consumed. */
+static unsigned int drain_rings(struct aggregatorShard *s)
+{
+    struct spscRing *r, *next;
+    unsigned int n = 0;
+
+    pthread_mutex_lock(&s->ring_mutex);
+    for (r = s->rings; r; r = next) {
+        next = r->next;
+        /* The producer publishes before closing, so a closed ring is
+         * empty once drained */
+        int closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+        n += spscring_drain(r, handle_packet_arrival, s);
+        if (closed) {
+            unregister_ring_unsafe(s, r);
+        }
+    }
+    pthread_mutex_unlock(&s->ring_mutex);
+
+    return n;
+}
+
+static void *aggregator_ring_thread(struct aggregatorShard *s)
+{
+    struct timespec now, ref;
+    struct timespec nap = { 0, RING_IDLE_POLL_NS };
+    struct spscRing *r, *next;
+    clockid_t clock;
+
+    pthread_mutex_lock(&s->ring_mutex);
+    s->rings_polled = 1;
+    pthread_mutex_unlock(&s->ring_mutex);
+
+    /* Allocate the initial hashmap */
+    add_hashmap(&s->working_a, NULL);
+
+    clock = fistq_getclock();
+    clock_gettime(clock, &ref);
+    setNextInterval(&ref, &aggregator_interval);
+
+    while (!pd3_estimator_done) {
+        if (timesource_virtual()) {
+            /* Take in the packets published before the clock moved,
+             * then start the periods it went past */
+            TIMESTAMP t = timesource_now();
+            if (drain_rings(s) == 0) {
+                if (t >= s->period_end) {
+                    virtual_transitions(s, t);
+                } else {
+                    nanosleep(&nap, NULL);
+                }
+            }
+            continue;
+        }
+
+        clock_gettime(clock, &now);
+
+        /* Time to start the next interval */
+        if (timeCmp(&now, &ref) > 0) {
+            period_transition(s);
+            setNextInterval(&ref, &aggregator_interval);
+            continue;
+        }
+
+        /* Nothing to process */
+        if (drain_rings(s) == 0) {
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    /* Nobody is left to drain closed rings */
+    pthread_mutex_lock(&s->ring_mutex);
+    s->rings_polled = 0;
+    for (r = s->rings; r; r = next) {
+        next = r->next;
+        if (atomic_load_explicit(&r->closed, memory_order_acquire)) {
+            unregister_ring_unsafe(s, r);
+        }
     }
+    pthread_mutex_unlock(&s->ring_mutex);
+
+    return NULL;
 }
 
 static void *aggregator_thread(void *arg)
 {
+    struct aggregatorShard *s = arg;
     fistq_handle *client2agg;
     struct timespec now, ref;
+    struct timespec poll = { 0, VIRTUAL_CLOCK_POLL_NS };
     clockid_t clock;
 
-    (void)arg;
+    if (ring_size) {
+        return aggregator_ring_thread(s);
+    }
 
     /* Create fistq handle for receiving events from the client */
-    client2agg = fistq_getHandle(FISTQ_SRC, FISTQ_DST, FISTQ_FREE, NULL);
+    client2agg = fistq_getHandle(FISTQ_SRC, s->fistq_dst, FISTQ_FREE, NULL);
     if (!client2agg) {
         fprintf(stderr, "Could not create handle\n");
         return NULL;
     }
 
     /* Allocate the initial hashmap */
-    add_hashmap(&working_a, NULL);
+    add_hashmap(&s->working_a, NULL);
 
     clock = fistq_getclock();
     clock_gettime(clock, &ref);
@@ -428,18 +1253,44 @@ static void *aggregator_thread(void *arg)
         fistq_data_type type;
         void *data;
 
-        clock_gettime(clock, &now);
-
-        /* Time to start the next interval */
-        if (timeCmp(&now, &ref) > 0 || (data = fistq_timeddequeue_any(client2agg, &type, &ref)) == NULL) {
-            period_transition();
-            setNextInterval(&ref, &aggregator_interval);
-            continue;
+        if (timesource_virtual()) {
+            /* Take in the packets flushed before the clock moved,
+             * then start the periods it went past */
+            TIMESTAMP t = timesource_now();
+            clock_gettime(clock, &now);
+            setNextInterval(&now, &poll);
+            if ((data = fistq_timeddequeue_any(client2agg, &type, &now)) == NULL) {
+                virtual_transitions(s, t);
+                continue;
+            }
+        }
+        else {
+            clock_gettime(clock, &now);
+
+            /* Time to start the next interval */
+            if (timeCmp(&now, &ref) > 0 || (data = fistq_timeddequeue_any(client2agg, &type, &ref)) == NULL) {
+                period_transition(s);
+                setNextInterval(&ref, &aggregator_interval);
+                continue;
+            }
         }
 
         /* Something to process */
+        if (type == FISTQ_TYPE_PINFO_BATCH) {
+            struct pinfoBatch *b = data;
+            for (unsigned int i = 0; i < b->count; i++) {
+                handle_packet_arrival(s, &b->pinfo[i]);
+            }
+
+            /* Recycle the batch, eventually back to the clients */
+            put_pinfobatch(&s->free_batches_a, b);
+            if (s->free_batches_a.count >= PINFOBATCH_RETURN_THRESHOLD) {
+                return_batches(s);
+            }
+            continue;
+        }
         if (type == FISTQ_TYPE_PINFO) {
-            handle_packet_arrival(data);
+            handle_packet_arrival(s, data);
         }
 
         /* Clean up */
@@ -451,21 +1302,76 @@ static void *aggregator_thread(void *arg)
     return NULL;
 }
 
+/* Has any shard handed over a period? */
 static inline unsigned int pending_hashmaps()
 {
-    return working_sh.count;
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < num_shards; i++) {
+        n += shards[i].working_sh.count;
+    }
+    return n;
+}
+
+/* Does every shard hold enough periods for the reporter to process the
+ * earliest one? */
+static inline int periods_ready()
+{
+    for (unsigned int i = 0; i < num_shards; i++) {
+        if (shards[i].working_r.count < periods_to_wait) {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 static void data_exchange_reporter_unsafe()
 {
-    /* move all working hashmaps into reporter */
-    moveall_hashmap(&working_r, &working_sh);
+    for (unsigned int i = 0; i < num_shards; i++) {
+        struct aggregatorShard *s = &shards[i];
+
+        /* move all working hashmaps into reporter */
+        s->unlinked += s->working_sh.count;
+        moveall_hashmap(&s->working_r, &s->working_sh);
+
+        /* move freelists into shared area */
+        moveall_hashmap(&s->free_hashmaps_sh, &s->free_hashmaps_r);
+        move_hmilist(&s->free_hashmapitems_sh, &s->free_hashmapitems_r);
+        move_seqnorangelist(&s->free_lossranges_sh, &s->free_lossranges_r);
+        move_seqnobitmaplist(&s->free_lossbitmaps_sh, &s->free_lossbitmaps_r);
+        move_seqnorangelist(&s->free_reorderranges_sh, &s->free_reorderranges_r);
+    }
+}
+
+/* Links each stream's items in the periods newly handed to the reporter
+ * to the stream's item in the next period in which it appears, so that
+ * lookahead needs no lookups. A stream's latest item is only linked if
+ * the reporter still holds its period. */
+static void link_periods(struct aggregatorShard *s)
+{
+    struct hashMap *hm;
+    struct hashMapItem *hmi;
+    struct streamData *sd;
+    unsigned int held;
 
-    /* move freelists into shared area */
-    moveall_hashmap(&free_hashmaps_sh, &free_hashmaps_r);
-    move_hmilist(&free_hashmapitems_sh, &free_hashmapitems_r);
-    move_seqnorangelist(&free_lossranges_sh, &free_lossranges_r);
-    move_seqnorangelist(&free_reorderranges_sh, &free_reorderranges_r);
+    if (s->unlinked == 0) {
+        return;
+    }
+    held = s->working_r.earliest->epoch;
+    for (hm = s->working_r.latest; s->unlinked > 1; s->unlinked--) {
+        hm = hm->previous;
+    }
+    for (; hm; hm = hm->next) {
+        for (hmi = hm->items.head; hmi; hmi = hmi->next) {
+            sd = &hmi->value.agg_data.stream->value.stream_data;
+            if (sd->latest && (int) (sd->latest_epoch - held) >= 0) {
+                sd->latest->value.agg_data.next_period = hmi;
+            }
+            sd->latest = hmi;
+            sd->latest_epoch = hm->epoch;
+        }
+    }
+    s->unlinked = 0;
 }
 
 static void accumulate_time(struct reporterData *accum, struct reporterData *unit)
@@ -492,30 +1398,332 @@ static void accumulate_flow(struct reporterData *accum, struct reporterData *uni
     }
 }
 
+/* Number of streams a reporter worker claims at a time */
+#define REPORTER_WORKER_CHUNK 32
+
+/* A stream of the period being processed, and the pane record it
+ * accumulates into, if any */
+struct a2rJob {
+    struct hashMapItem *hmi_a;
+    struct hashMapItem *hmi_r;
+};
+
+/* Streams of the period being processed, shared by the reporter
+ * workers. Each stream appears once per period and owns its state
+ * and pane record, so workers need no locking beyond claiming
+ * streams. Each worker has its own scratch record. */
+struct a2rWork {
+    struct a2rJob *jobs;
+    unsigned int count, capacity;
+    _Atomic unsigned int next;    /* next unclaimed job */
+    struct reporterData **rd;     /* one per worker */
+    size_t rd_size;
+};
+
+/* Convert a stream's aggregator data to reporter data, carrying its
+ * state over, and accumulate it into its pane record */
+static void a2r_stream(struct reporterData *rd, size_t rd_size, struct a2rJob *job)
+{
+    struct hashMapItem *hmi_a = job->hmi_a;
+    struct stateData *st = &hmi_a->value.agg_data.stream->value.stream_data.state;
+
+    memset(rd, 0, rd_size);
+    packetdata_a2r(&rd->received, &hmi_a->value.agg_data.received);
+    if (loss_enabled) {
+        lossdata_a2r(&rd->loss, &hmi_a->value.agg_data.loss,
+                     &st->loss, hmi_a, periods_to_wait);
+    }
+    if (reorder_extent_enabled || reorder_density_enabled) {
+        reorderdata_a2r(&rd->reorder, &hmi_a->value.agg_data.reorder,
+                        &st->reorder);
+    }
+    if (job->hmi_r) {
+        accumulate_time(&job->hmi_r->value.rep_data, rd);
+    }
+}
+
+static void a2r_task(void *arg, unsigned int worker)
+{
+    struct a2rWork *w = arg;
+    unsigned int k, end;
+
+    while ((k = atomic_fetch_add(&w->next, REPORTER_WORKER_CHUNK)) < w->count) {
+        end = min(k + REPORTER_WORKER_CHUNK, w->count);
+        for (; k < end; k++) {
+            a2r_stream(w->rd[worker], w->rd_size, &w->jobs[k]);
+        }
+    }
+}
+
+/* Queue a stream for the workers. Returns 0 on success, -1 on
+ * error. */
+static int a2r_add(struct a2rWork *w, struct hashMapItem *hmi_a, struct hashMapItem *hmi_r)
+{
+    struct a2rJob *jobs;
+
+    if (w->count == w->capacity) {
+        unsigned int capacity = w->capacity ? 2 * w->capacity : 1024;
+
+        jobs = realloc(w->jobs, capacity * sizeof(*jobs));
+        if (!jobs) {
+            return -1;
+        }
+        w->jobs = jobs;
+        w->capacity = capacity;
+    }
+    w->jobs[w->count].hmi_a = hmi_a;
+    w->jobs[w->count].hmi_r = hmi_r;
+    w->count++;
+    return 0;
+}
+
+static void a2r_work_destroy(struct a2rWork *w)
+{
+    if (w->rd) {
+        for (unsigned int i = 0; i < num_reporter_workers; i++) {
+            free(w->rd[i]);
+        }
+    }
+    free(w->rd);
+    free(w->jobs);
+}
+
+/* Reporter records accumulated over the periods between two
+ * consecutive report window starts. Each schedule entry's window
+ * covers the pane in which it starts and every later pane, so each
+ * period is accumulated once, into the newest pane, however many
+ * entries' windows it falls in. A pane in which no window starts is
+ * folded into the previous pane, which keeps at most one pane per
+ * schedule entry, plus the newest. */
+struct pane {
+    struct hashMap streams;
+    unsigned int starts;    /* schedule entries whose window starts here */
+    struct pane *previous, *next;
+};
+
+struct paneList {
+    struct pane *oldest, *newest;
+    struct pane *free;      /* linked with next */
+};
+
+/* Accumulate every stream record of `from` into `to` */
+static void merge_streams(struct hashMap *to, struct hashMap *from)
+{
+    struct hashMapItem *hmi, *hmi_r;
+
+    for (hmi = from->items.head; hmi; hmi = hmi->next) {
+        hmi_r = hashmap_force(to, &hmi->key, &free_hmis_tracker);
+        if (!hmi_r) {
+            continue;
+        }
+        accumulate_time(&hmi_r->value.rep_data, &hmi->value.rep_data);
+    }
+}
+
+/* Link a fresh pane as the newest. The free list always has one,
+ * since there is never more than one pane per schedule entry plus
+ * the newest. */
+static struct pane *open_pane(struct paneList *pl)
+{
+    struct pane *p = pl->free;
+
+    pl->free = p->next;
+    p->starts = 0;
+    p->next = NULL;
+    p->previous = pl->newest;
+    if (pl->newest) {
+        pl->newest->next = p;
+    }
+    else {
+        pl->oldest = p;
+    }
+    pl->newest = p;
+    return p;
+}
+
+/* Fold the panes in which no window starts any more into the previous
+ * pane, whose windows cover them too, or drop them if no window does */
+static void coalesce_panes(struct paneList *pl)
+{
+    struct pane *p, *next;
+
+    for (p = pl->oldest; p; p = next) {
+        next = p->next;
+        if (p->starts > 0) {
+            continue;
+        }
+        if (p->previous) {
+            merge_streams(&p->previous->streams, &p->streams);
+            p->previous->next = next;
+        }
+        else {
+            pl->oldest = next;
+        }
+        if (next) {
+            next->previous = p->previous;
+        }
+        else {
+            pl->newest = p->previous;
+        }
+        zeroout_hashmap(&p->streams, &free_hmis_tracker);
+        p->next = pl->free;
+        pl->free = p;
+    }
+}
+
+/* Storage for the results handed to the callbacks, reused across
+ * reports and sized by reorderdata_init(). The extent bin bounds
+ * never change. Each flow of a batch gets its own 2 * DT + 1 density
+ * bins. */
+struct resultBuffer {
+    uint32_t *extent_min;
+    uint32_t *extent_max;
+    pd3_estimator_results *results;
+    pd3_estimator_reorder_density_bin *density;
+    size_t capacity;    /* flows */
+
+    /* Sparse extent bins of the report being delivered */
+    struct sparseBlock *sparse_blocks, *sparse_current;
+};
+
+/* Sparse extent bins are kept in blocks, which never move while
+ * later flows are added, so that each flow's bins stay contiguous and
+ * valid until the callback returns. Blocks are reused across
+ * reports. */
+#define SPARSE_BLOCK_SIZE 4096
+struct sparseBlock {
+    struct sparseBlock *next;
+    size_t used, size;
+    pd3_estimator_reorder_extent_bin bins[];
+};
+
+/* Returns room for `count` contiguous sparse bins, to be claimed by
+ * adding to sparse_current->used, or NULL on error */
+static pd3_estimator_reorder_extent_bin *sparse_bins_reserve(struct resultBuffer *buf, size_t count)
+{
+    struct sparseBlock *b = buf->sparse_current;
+
+    while (b && b->size - b->used < count) {
+        b = b->next;
+        if (b) {
+            b->used = 0;
+        }
+    }
+    if (!b) {
+        size_t size = max(count, (size_t) SPARSE_BLOCK_SIZE);
+
+        b = malloc(sizeof(*b) + size * sizeof(b->bins[0]));
+        if (!b) {
+            fprintf(stderr, "malloc failed\n");
+            return NULL;
+        }
+        b->used = 0;
+        b->size = size;
+        /* Insert after the current block */
+        if (buf->sparse_current) {
+            b->next = buf->sparse_current->next;
+            buf->sparse_current->next = b;
+        }
+        else {
+            b->next = buf->sparse_blocks;
+            buf->sparse_blocks = b;
+        }
+    }
+    buf->sparse_current = b;
+    return &b->bins[b->used];
+}
+
+/* Start a report: every block is free again */
+static void sparse_bins_reset(struct resultBuffer *buf)
+{
+    buf->sparse_current = buf->sparse_blocks;
+    if (buf->sparse_current) {
+        buf->sparse_current->used = 0;
+    }
+}
+
+static void result_buffer_destroy(struct resultBuffer *buf)
+{
+    struct sparseBlock *b, *next;
+
+    free(buf->extent_min);
+    free(buf->extent_max);
+    free(buf->results);
+    free(buf->density);
+    for (b = buf->sparse_blocks; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+}
+
+/* Make room for `count` flows. Returns 0 on success, -1 on error, in
+ * which case the buffer keeps its previous capacity. */
+static int result_buffer_reserve(struct resultBuffer *buf, size_t count)
+{
+    size_t density_bins = 2 * reorderdata_dt() + 1;
+    pd3_estimator_results *results;
+    pd3_estimator_reorder_density_bin *density;
+
+    if (count <= buf->capacity) {
+        return 0;
+    }
+    results = realloc(buf->results, count * sizeof(*results));
+    if (!results) {
+        return -1;
+    }
+    buf->results = results;
+    density = realloc(buf->density, count * density_bins * sizeof(*density));
+    if (!density) {
+        return -1;
+    }
+    buf->density = density;
+    buf->capacity = count;
+    return 0;
+}
 
-static pd3_estimator_results build_callback_results(struct hashMapItem *hmi_r, TIMEINTERVAL duration, struct hashMap *cumulative_data)
+/* Returns 0 on success, -1 on error */
+static int result_buffer_init(struct resultBuffer *buf)
 {
-    pd3_estimator_results results;
-    (void) cumulative_data;
+    unsigned int num_extent_bins = reorderdata_num_extent_bins();
+
+    memset(buf, 0, sizeof(*buf));
+    buf->extent_min = calloc(num_extent_bins + 1, sizeof(*buf->extent_min));
+    buf->extent_max = calloc(num_extent_bins + 1, sizeof(*buf->extent_max));
+    if (!buf->extent_min || !buf->extent_max || result_buffer_reserve(buf, 1) == -1) {
+        result_buffer_destroy(buf);
+        return -1;
+    }
+    for (unsigned int i = 0; i < num_extent_bins; i++) {
+        reorderdata_extent_bin_bounds(i, &buf->extent_min[i], &buf->extent_max[i]);
+    }
+    return 0;
+}
 
-    memset(&results, 0, sizeof(results));
+/* Fill in `results` for the flow record `hmi_r`. The extent bins
+ * point into the record itself; the density bins are written to
+ * `density`, which holds 2 * DT + 1 bins. */
+static void build_callback_results(pd3_estimator_results *results, struct hashMapItem *hmi_r,
+                                   TIMEINTERVAL duration, struct resultBuffer *buf,
+                                   pd3_estimator_reorder_density_bin *density)
+{
+    memset(results, 0, sizeof(*results));
 
     /* Set up the flow key */
-    memcpy(results.flow_key, hmi_r->key.key.stream.flow_key, sizeof(results.flow_key));
+    memcpy(results->flow_key, hmi_r->key.key.stream.flow_key, sizeof(results->flow_key));
 
     /* Set bounding timestamps for measurements */
-    results.earliest = hmi_r->value.rep_data.received.earliest;
-    results.latest = hmi_r->value.rep_data.received.latest;
+    results->earliest = hmi_r->value.rep_data.received.earliest;
+    results->latest = hmi_r->value.rep_data.received.latest;
 
     /* Set bounding sequence numbers for measurements */
-    results.min_seq = hmi_r->value.rep_data.received.minSeq;
-    results.max_seq = hmi_r->value.rep_data.received.maxSeq;
+    results->min_seq = hmi_r->value.rep_data.received.minSeq;
+    results->max_seq = hmi_r->value.rep_data.received.maxSeq;
 
     /* Set the packet count */
-    results.packet_count = hmi_r->value.rep_data.received.packet_count;
+    results->packet_count = hmi_r->value.rep_data.received.packet_count;
 
     /* Set the duration */
-    results.duration = duration;
+    results->duration = duration;
 
     /* Set loss results */
     if (loss_enabled) {
@@ -527,90 +1735,249 @@ static pd3_estimator_results build_callback_results(struct hashMapItem *hmi_r, T
             loss = d / (r + d);
             c = ldr->consecutive_drops;
             ac = (d != 0.0 ? ((c*r) + (c*d) - (d*d)) / (d*r) : 0.0);
-            results.loss_results.packets_received = r;
-            results.loss_results.packets_dropped = d;
-            results.loss_results.consecutive_drops = c;
-            results.loss_results.autocorr = ac;
-            results.loss_results.value = loss;
-            results.loss = 1;
+            results->loss_results.packets_received = r;
+            results->loss_results.packets_dropped = d;
+            results->loss_results.consecutive_drops = c;
+            results->loss_results.autocorr = ac;
+            results->loss_results.value = loss;
+            results->loss = 1;
         }
     }
 
     /* Set the reorder extent results */
     if (reorder_extent_enabled) {
         struct reorderDataR *rdr = &hmi_r->value.rep_data.reorder;
+        PACKETCOUNT *extents = reorderdata_extents(rdr);
+        unsigned int num_extent_bins = reorderdata_num_extent_bins();
 
         size_t num_bins = 0;
-        for (int i = 0; i < REORDER_MAX_EXTENT; i++) {
-            results.reorder_extent_results.bins[i] = rdr->extentToCount[i];
-            if (rdr->extentToCount[i] > 0) {
-                num_bins++;
+        if (sparse_results) {
+            /* List the non-zero bins only */
+            pd3_estimator_reorder_extent_bin *sparse = sparse_bins_reserve(buf, num_extent_bins);
+            if (sparse) {
+                for (unsigned int i = 0; i < num_extent_bins; i++) {
+                    if (extents[i] > 0) {
+                        sparse[num_bins].min_extent = buf->extent_min[i];
+                        sparse[num_bins].max_extent = buf->extent_max[i];
+                        sparse[num_bins].count = extents[i];
+                        num_bins++;
+                    }
+                }
+                buf->sparse_current->used += num_bins;
             }
+            results->reorder_extent_results.sparse_bins = sparse;
+            results->reorder_extent_results.num_bins = num_bins;
         }
-        if (num_bins > 0) {
-            results.reorder_extent_results.num_bins = REORDER_MAX_EXTENT;
+        else {
+            results->reorder_extent_results.bins = extents;
+            results->reorder_extent_results.bin_min_extent = buf->extent_min;
+            results->reorder_extent_results.bin_max_extent = buf->extent_max;
+            for (unsigned int i = 0; i < num_extent_bins; i++) {
+                if (extents[i] > 0) {
+                    num_bins++;
+                }
+            }
+            if (num_bins > 0) {
+                results->reorder_extent_results.num_bins = num_extent_bins;
+            }
         }
-        results.reorder_extent_results.assumed_drops = rdr->extent_assumed_drops;
+        results->reorder_extent_results.assumed_drops = rdr->extent_assumed_drops;
         /* We have something useful to say */
         if (num_bins > 0 || rdr->extent_assumed_drops > 0) {
-            results.reorder_extent = 1;
+            results->reorder_extent = 1;
         }
     }
 
     /* Set the reorder density results */
     if (reorder_density_enabled) {
         struct reorderDataR *rdr = &hmi_r->value.rep_data.reorder;
+        PACKETCOUNT *fd = reorderdata_fd(rdr);
+        int dt = reorderdata_dt();
 
         /* Count the number of non-zero entries */
         size_t num_entries = 0;
-        for (int i = 0; i < REORDER_WINDOW_SIZE; i++) {
-            PACKETCOUNT frequency = rdr->FD[i];
-            int distance = i - REORDER_DT;
-            results.reorder_density_results.bins[i].frequency = frequency;
-            results.reorder_density_results.bins[i].distance = distance;
+        results->reorder_density_results.bins = density;
+        for (int i = 0; i < 2 * dt + 1; i++) {
+            PACKETCOUNT frequency = fd[i];
+            int distance = i - dt;
+            if (sparse_results && frequency == 0) {
+                continue;
+            }
+            /* Sparse results pack the non-zero bins at the front */
+            density[sparse_results ? num_entries : (size_t) i].frequency = frequency;
+            density[sparse_results ? num_entries : (size_t) i].distance = distance;
             if (frequency > 0) {
                 num_entries++;
             }
         }
         /* We have something useful to say */
-        if (num_entries > 0) {
-            results.reorder_density_results.num_bins = REORDER_WINDOW_SIZE;
+        if (sparse_results) {
+            results->reorder_density_results.num_bins = num_entries;
+        }
+        else if (num_entries > 0) {
+            results->reorder_density_results.num_bins = 2 * dt + 1;
         }
         // FIXME: not currently calculating assumed drops for RD
-        // results.reorder_density_results.assumed_drops = rdr->rd_assumed_drops;
+        // results->reorder_density_results.assumed_drops = rdr->rd_assumed_drops;
         if (num_entries > 0 || rdr->rd_assumed_drops > 0) {
-            results.reorder_density = 1;
+            results->reorder_density = 1;
+        }
+    }
+}
+
+/* Is the record a flow on which there is something to report? */
+static inline int reportable_flow(struct hashMapItem *hmi_r)
+{
+    return hmi_r->key.keytype == HMK_FLOWTUPLE &&
+        hmi_r->value.rep_data.received.packet_count > 0;
+}
+
+/* Keep a flow's results for queries and the results ring */
+static inline void publish_flow(pd3_estimator_results *results, bool to_ring)
+{
+    if (snapshots) {
+        snapshot_add(snapshots, results);
+    }
+    if (to_ring) {
+        resultring_add(results_ring, results);
+    }
+}
+
+/* Hand every flow of a report to the callback if `to_callbacks`, to
+ * the results ring if `to_ring`, and to the query snapshot */
+static void deliver_results(struct hashMap *report, TIMEINTERVAL duration,
+                            struct resultBuffer *buf, bool to_callbacks, bool to_ring)
+{
+    size_t density_bins = 2 * reorderdata_dt() + 1;
+    struct hashMapItem *hmi_r;
+    size_t count = 0, n = 0;
+
+    if (snapshots) {
+        snapshot_begin(snapshots);
+    }
+
+    if (!to_callbacks || !callbacks.batch_cb) {
+        for (hmi_r = report->items.head; hmi_r; hmi_r = hmi_r->next) {
+            if (reportable_flow(hmi_r)) {
+                sparse_bins_reset(buf);
+                build_callback_results(buf->results, hmi_r, duration, buf, buf->density);
+                publish_flow(buf->results, to_ring);
+                if (to_callbacks && callbacks.cb) {
+                    callbacks.cb(callbacks.context, buf->results);
+                }
+            }
+        }
+    }
+    else {
+        /* Deliver the whole report in one call if there is room for
+         * it, in as few calls as the buffer allows otherwise */
+        for (hmi_r = report->items.head; hmi_r; hmi_r = hmi_r->next) {
+            if (reportable_flow(hmi_r)) {
+                count++;
+            }
+        }
+        if (result_buffer_reserve(buf, count) == -1) {
+            fprintf(stderr, "realloc failed\n");
+        }
+        sparse_bins_reset(buf);
+        for (hmi_r = report->items.head; hmi_r; hmi_r = hmi_r->next) {
+            if (!reportable_flow(hmi_r)) {
+                continue;
+            }
+            build_callback_results(&buf->results[n], hmi_r, duration, buf,
+                                   &buf->density[n * density_bins]);
+            publish_flow(&buf->results[n], to_ring);
+            if (++n == buf->capacity) {
+                callbacks.batch_cb(callbacks.context, buf->results, n);
+                sparse_bins_reset(buf);
+                n = 0;
+            }
+        }
+        if (n > 0) {
+            callbacks.batch_cb(callbacks.context, buf->results, n);
         }
     }
 
-    return results;
+    if (snapshots) {
+        snapshot_publish(snapshots);
+    }
+    if (to_ring) {
+        resultring_end_report(results_ring, duration);
+    }
 }
 
 static void *reporter_thread(void *arg)
 {
-    struct hashMapItem *hmi_a, *hmi_st, *hmi_r, *hmi_g;
-    struct hashMap state_data;
+    struct hashMapItem *hmi_a, *hmi_r, *hmi_g;
     struct hashMapKey flowkey;
-    struct reporterData rd;
+    struct a2rWork work;
+    struct workerPool *pool = NULL;
+    struct resultBuffer results;
     unsigned int ntrackers;
     char *outlets;
-    struct hashMap *trackers = NULL;
+    struct pane *panes, *window_pane, **window_start;
+    struct paneList pl;
+    struct hashMap report;
+    TIMESTAMP report_time, period_end;
 
     (void) arg;
 
-    /* Set up the trackers */
+    /* Set up the panes: all windows start in the first one */
     ntrackers = schedule_parallelism();
     if (ntrackers == 0) {
         fprintf(stderr, "reporter error: no trackers\n");
         return NULL;
     }
-    trackers = calloc(ntrackers, sizeof(*trackers));
-    if (!trackers) {
+    panes = calloc(ntrackers + 1, sizeof(*panes));
+    window_start = calloc(ntrackers, sizeof(*window_start));
+    if (!panes || !window_start) {
         fprintf(stderr, "calloc failed\n");
+        free(panes);
+        free(window_start);
+        return NULL;
+    }
+    memset(&pl, 0, sizeof(pl));
+    for (unsigned int i = 0; i <= ntrackers; i++) {
+        panes[i].next = pl.free;
+        pl.free = &panes[i];
+    }
+    window_pane = open_pane(&pl);
+    for (unsigned int i = 0; i < ntrackers; i++) {
+        window_start[i] = window_pane;
+        window_pane->starts++;
+    }
+    memset(&report, 0, sizeof(report));
+
+    /* Reporter records and result bins are sized to the configured
+     * reorder limits */
+    memset(&work, 0, sizeof(work));
+    work.rd_size = offsetof(struct reporterData, reorder) + reorderdata_size();
+    work.rd = calloc(num_reporter_workers, sizeof(*work.rd));
+    for (unsigned int i = 0; work.rd && i < num_reporter_workers; i++) {
+        work.rd[i] = malloc(work.rd_size);
+        if (!work.rd[i]) {
+            break;
+        }
+    }
+    if (!work.rd || !work.rd[num_reporter_workers - 1] || result_buffer_init(&results) == -1) {
+        fprintf(stderr, "malloc failed\n");
+        a2r_work_destroy(&work);
+        free(panes);
+        free(window_start);
+        return NULL;
+    }
+    pool = workerpool_create(num_reporter_workers, a2r_task, &work);
+    if (!pool) {
+        fprintf(stderr, "could not start reporter workers\n");
+        a2r_work_destroy(&work);
+        result_buffer_destroy(&results);
+        free(panes);
+        free(window_start);
         return NULL;
     }
 
-    memset(&state_data, 0, sizeof(state_data));
+    free_hmis_tracker.role = HMI_TRACKER;
+    period_end = virtual_clock_start + aggregator_interval_us;
 
     while (!pd3_estimator_done) {
         /* Wait for a new hashmap */
@@ -631,87 +1998,117 @@ static void *reporter_thread(void *arg)
 
         pthread_mutex_unlock(&shared_mutex);
 
-        /* process hashmaps */
-        while (working_r.count >= periods_to_wait) {
-            for (hmi_a = working_r.earliest->items.head; hmi_a; hmi_a = hmi_a->next) {
-                /* convert aggregator data structures to reporter data structures */
-                hmi_st = hashmap_force(&state_data, &hmi_a->key, &free_hmis_local);
-                memset(&rd, 0, sizeof(rd));
-                packetdata_a2r(&rd.received, &hmi_a->value.agg_data.received);
-                if (loss_enabled) {
-                    lossdata_a2r(&rd.loss, &hmi_a->value.agg_data.loss,
-                                 &hmi_st->value.state_data.loss,
-                                 working_r.earliest->next, &hmi_a->key,
-                                 periods_to_wait);
-                }
-                if (reorder_extent_enabled || reorder_density_enabled) {
-                    reorderdata_a2r(&rd.reorder, &hmi_a->value.agg_data.reorder,
-                                    &hmi_st->value.state_data.reorder);
-                }
-                for (unsigned int i = 0; i < ntrackers; i++) {
-                    hmi_r = hashmap_force(&trackers[i], &hmi_a->key, &free_hmis_local);
-                    accumulate_time(&hmi_r->value.rep_data, &rd);
+        for (unsigned int j = 0; j < num_shards; j++) {
+            link_periods(&shards[j]);
+        }
+
+        /* process hashmaps, merging the shards' streams period by period */
+        while (periods_ready()) {
+            /* On the virtual clock, reports are due by the end of the
+             * period, so that they always cover the same periods */
+            if (timesource_virtual()) {
+                report_time = period_end;
+                period_end += aggregator_interval_us;
+            }
+            else {
+                report_time = timesource_now();
+            }
+
+            /* Find each stream's pane record, then convert aggregator
+             * data structures to reporter data structures in parallel */
+            work.count = 0;
+            atomic_store(&work.next, 0);
+            for (unsigned int j = 0; j < num_shards; j++) {
+                struct hashMapList *working_r = &shards[j].working_r;
+
+                for (hmi_a = working_r->earliest->items.head; hmi_a; hmi_a = hmi_a->next) {
+                    hmi_r = hashmap_force(&pl.newest->streams, &hmi_a->key, &free_hmis_tracker);
+                    if (a2r_add(&work, hmi_a, hmi_r) == -1) {
+                        struct a2rJob job = { hmi_a, hmi_r };
+                        a2r_stream(work.rd[0], work.rd_size, &job);
+                    }
                 }
             }
+            workerpool_run(pool);
 
             /* Report! */
+            window_pane = NULL;
             for (unsigned int i = 0; i < ntrackers; i++) {
-                outlets = schedule_outlets(i);
+                outlets = schedule_outlets(i, report_time);
                 if (outlets == NULL) {
                     continue;
                 }
+                /* Merge the panes making up the window */
+                for (struct pane *p = window_start[i]; p; p = p->next) {
+                    merge_streams(&report, &p->streams);
+                }
                 /* Consolidate stream-level information into flow-level information */
-                for (hmi_r = trackers[i].items.head; hmi_r; hmi_r = hmi_r->next) {
+                for (hmi_r = report.items.head; hmi_r; hmi_r = hmi_r->next) {
                     if (hmi_r->key.keytype == HMK_STREAMTUPLE) {
-                        hashmap_force(&state_data, &hmi_r->key, &free_hmis_local);
                         /* Adding flowtuples to hashmap is safe, because:
                            (a) prepending before point of iteration, and
                            (b) iteration only operates on streams */
                         set_flowtuple(&flowkey, &hmi_r->key.key.stream);
-                        hmi_g = hashmap_force(&trackers[i], &flowkey, &free_hmis_local);
+                        hmi_g = hashmap_force(&report, &flowkey, &free_hmis_tracker);
+                        if (!hmi_g) {
+                            continue;
+                        }
                         accumulate_flow(&hmi_g->value.rep_data, &hmi_r->value.rep_data);
                     }
                 }
-                if (strchr(outlets, 'c')) {
-                    if (callbacks.cb) {
+                if (strchr(outlets, 'c') || strchr(outlets, 'm')) {
+                    bool to_callbacks = strchr(outlets, 'c') && (callbacks.cb || callbacks.batch_cb);
+                    bool to_ring = strchr(outlets, 'm') && results_ring;
+                    if (to_callbacks || to_ring || snapshots) {
                         /* now includes flowgroups */
-                        for (hmi_r = trackers[i].items.head; hmi_r; hmi_r = hmi_r->next) {
-                            /* Only process flows */
-                            if (hmi_r->key.keytype != HMK_FLOWTUPLE) {
-                                continue;
-                            }
-                            /* Skip over this flow if we didn't see any packets */
-                            if (hmi_r->value.rep_data.received.packet_count == 0) {
-                                continue;
-                            }
-                            pd3_estimator_results results = build_callback_results(hmi_r, get_duration(i), NULL);
-                            callbacks.cb(callbacks.context, &results);
-                        }
+                        deliver_results(&report, get_duration(i), &results,
+                                        to_callbacks, to_ring);
                     }
                 }
                 else {
                     fprintf(stderr, "Unsupported outlet: %s\n", outlets);
                 }
-                schedule_reset(i);
+                schedule_reset(i, report_time);
                 /* zeroout_hashmap() should not and does not free ranges in reporter data objects */
-                zeroout_hashmap(&trackers[i], &free_hmis_local);
+                zeroout_hashmap(&report, &free_hmis_tracker);
+
+                /* The next window starts with the next period */
+                if (!window_pane) {
+                    window_pane = open_pane(&pl);
+                }
+                window_start[i]->starts--;
+                window_start[i] = window_pane;
+                window_pane->starts++;
+            }
+            if (window_pane) {
+                coalesce_panes(&pl);
             }
-            /* recycle storage, eventually to aggregator */
-            for (hmi_a = working_r.earliest->items.head; hmi_a; hmi_a = hmi_a->next) {
-                move_seqnorangelist(&free_lossranges_r, &hmi_a->value.agg_data.loss.ranges);
-                move_seqnorangelist(&free_reorderranges_r, &hmi_a->value.agg_data.reorder.ranges);
+            /* recycle storage, eventually to the owning aggregator */
+            for (unsigned int j = 0; j < num_shards; j++) {
+                struct aggregatorShard *s = &shards[j];
+
+                for (hmi_a = s->working_r.earliest->items.head; hmi_a; hmi_a = hmi_a->next) {
+                    move_seqnorangelist(&s->free_lossranges_r, &hmi_a->value.agg_data.loss.ranges);
+                    move_seqnobitmaplist(&s->free_lossbitmaps_r, &hmi_a->value.agg_data.loss.bitmap);
+                    move_seqnorangelist(&s->free_reorderranges_r, &hmi_a->value.agg_data.reorder.ranges);
+                }
+                move_hmilist(&s->free_hashmapitems_r, &s->working_r.earliest->items);
+                moveone_hashmap(&s->free_hashmaps_r, &s->working_r);
             }
-            move_hmilist(&free_hashmapitems_r, &working_r.earliest->items);
-            moveone_hashmap(&free_hashmaps_r, &working_r);
         }
     }
 
     /* Move reporter items back to a free list so they can be freed */
-    for (unsigned int i = 0; i < ntrackers; i++) {
-        zeroout_hashmap(&trackers[i], &free_hmis_local);
+    for (unsigned int i = 0; i <= ntrackers; i++) {
+        zeroout_hashmap(&panes[i].streams, &free_hmis_tracker);
+        hashmap_free_table(&panes[i].streams);
     }
-    zeroout_hashmap(&state_data, &free_hmis_local);
-    free(trackers);
+    hashmap_free_table(&report);
+    free(panes);
+    free(window_start);
+    workerpool_destroy(pool);
+    a2r_work_destroy(&work);
+    result_buffer_destroy(&results);
 
     return NULL;
 }
@@ -26,6 +26,7 @@
 #ifndef _PD3_ESTIMATOR_H_
 #define _PD3_ESTIMATOR_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -36,16 +37,30 @@
 #define PD3_ESTIMATOR_KEY_SIZE 2
 #endif
 
-/* Reorder extent: maximum extent value that will be considered */
+/* Reorder extent: default maximum extent value that will be
+ * considered, see pd3_estimator_options.reorder_max_extent */
 #ifndef REORDER_MAX_EXTENT
 #define REORDER_MAX_EXTENT 255
 #endif
 
-/* Reorder density: Displacement threshold, i.e., maximum size of
- * buffer. Distance values go from -DT to +DT. */
+/* Reorder density: default displacement threshold, i.e., maximum size
+ * of buffer. Distance values go from -DT to +DT. See
+ * pd3_estimator_options.reorder_dt */
 #ifndef REORDER_DT
 #define REORDER_DT 8
 #endif
+
+/* Maximum number of packet infos handed to the aggregator thread as a
+ * single unit by pd3_estimator_push_packet_infos() */
+#ifndef PD3_ESTIMATOR_BATCH_SIZE
+#define PD3_ESTIMATOR_BATCH_SIZE 256
+#endif
+
+/* Maximum number of streams that may be registered with
+ * pd3_estimator_register_stream() */
+#ifndef PD3_ESTIMATOR_MAX_STREAMS
+#define PD3_ESTIMATOR_MAX_STREAMS (1 << 20)
+#endif
 /*****************************************************************/
 
 
@@ -78,6 +93,17 @@ typedef struct pd3_estimator_packet_info {
 
     /* Sequence number of the packet within the stream */
     SEQNO seq;
+
+    /* Optional arrival time of the packet, in microseconds since the
+     * epoch. When 0, the aggregator thread stamps the packet with the
+     * time at which it processes it. */
+    TIMESTAMP timestamp;
+
+    /* Optional slot returned by pd3_estimator_register_stream(). When
+     * non-zero, the stream is identified by its slot and `stream` is
+     * ignored, sparing the service a hash lookup per packet. 0 means
+     * the stream is identified by `stream`. */
+    uint32_t slot;
 } pd3_estimator_packet_info;
 
 typedef struct pd3_estimator_loss_results {
@@ -105,25 +131,46 @@ typedef struct pd3_estimator_loss_results {
     double autocorr;
 } pd3_estimator_loss_results;
 
+/* Non-zero bin of a sparse reorder extent histogram */
+typedef struct pd3_estimator_reorder_extent_bin {
+    /* Range of extents counted by the bin */
+    uint32_t min_extent;
+    uint32_t max_extent;
+
+    /* Number of non-duplicate packets observed with an extent in the
+     * range during the measurement interval */
+    PACKETCOUNT count;
+} pd3_estimator_reorder_extent_bin;
+
 typedef struct pd3_estimator_reorder_extent_results {
     /* Number of bins containing valid results */
     uint32_t num_bins;
 
-    /* The bins making up the histogram. Only the first num_bins
-     * entries are valid. Each entry contains the number of
-     * non-duplicate packets observed with the given extent during the
-     * measurement interval. */
-    PACKETCOUNT bins[REORDER_MAX_EXTENT];
+    /* The bins making up the histogram, covering the extents below
+     * the maximum extent. Only the first num_bins entries are
+     * valid. Each entry contains the number of non-duplicate packets
+     * observed with an extent from bin_min_extent[i] to
+     * bin_max_extent[i] during the measurement interval. Unless
+     * reorder_extent_precision is set, bin i counts extent i
+     * only. The storage belongs to the library and is only valid
+     * until the callback returns. */
+    PACKETCOUNT *bins;
+    uint32_t *bin_min_extent;
+    uint32_t *bin_max_extent;
+
+    /* With the sparse_results option, the non-zero bins, num_bins of
+     * them, in increasing order of extent, replace the arrays above,
+     * which are then NULL. Same lifetime as `bins`. */
+    pd3_estimator_reorder_extent_bin *sparse_bins;
 
     /* The number of missing packets declared to be dropped during the
-     * interval because their extent would exceed
-     * REORDER_MAX_EXTENT. */
+     * interval because their extent would exceed the maximum
+     * extent. */
     PACKETCOUNT assumed_drops;
 } pd3_estimator_reorder_extent_results;
 
 typedef struct pd3_estimator_reorder_density_bin {
-    /* Distance value, falling in the range -REORDER_DT to
-     * REORDER_DT */
+    /* Distance value, falling in the range -DT to DT */
     int distance;
 
     /* Number of packets observed with the given distance during the
@@ -131,14 +178,18 @@ typedef struct pd3_estimator_reorder_density_bin {
     PACKETCOUNT frequency;
 } pd3_estimator_reorder_density_bin;
 
+/* Number of distance values for the default displacement threshold */
 #define REORDER_WINDOW_SIZE (REORDER_DT * 2 + 1)
 typedef struct pd3_estimator_reorder_density_results {
     /* Number of bins containing valid results */
     uint32_t num_bins;
 
-    /* The bins making up the histogram. Only the first num_bins
-     * entries are valid. */
-    pd3_estimator_reorder_density_bin bins[REORDER_WINDOW_SIZE];
+    /* The bins making up the histogram, one per distance value. Only
+     * the first num_bins entries are valid. With the sparse_results
+     * option, only the bins with a non-zero frequency are listed, in
+     * increasing order of distance. The storage belongs to the
+     * library and is only valid until the callback returns. */
+    pd3_estimator_reorder_density_bin *bins;
 } pd3_estimator_reorder_density_results;
 
 typedef struct pd3_estimator_results {
@@ -178,10 +229,125 @@ typedef struct pd3_estimator_callbacks {
      * argument to each callback */
     void *context;
 
-    /* Callback function to be invoked by the reporter thread */
+    /* Callback function to be invoked by the reporter thread, once
+     * per flow of each report */
     void (*cb)(void *context, pd3_estimator_results *results);
+
+    /* Optional callback function to be invoked by the reporter
+     * thread instead of `cb`, with the `count` flows of a report in
+     * one contiguous array. The array and the bins it points to
+     * belong to the library, are reused across reports and are only
+     * valid until the callback returns. Should memory run short, a
+     * report may be split across several calls. */
+    void (*batch_cb)(void *context, pd3_estimator_results *results, size_t count);
 } pd3_estimator_callbacks;
 
+/* Layout of the results ring file written by the 'm' outlet, see
+ * pd3_estimator_options.results_ring_path. The file starts with a
+ * header, followed at data_offset by `capacity` bytes of records
+ * written in a circle. Records are 8-byte aligned and never wrap
+ * around the end of the data; the writer fills the remainder with a
+ * padding record instead.
+ *
+ * There is a single writer and any number of readers, which never
+ * hold the writer up: a slow reader is overwritten. The writer
+ * advances `reserved` before writing a record and `committed` after.
+ * Both are byte positions that only grow, the record at position P
+ * living at data_offset + (P % capacity). A reader keeps its own
+ * position P, starting from `committed`, and while P is behind
+ * `committed` (loaded with acquire semantics):
+ *   - reads the record at P in place;
+ *   - loads `reserved` after an acquire fence. If reserved - P
+ *     exceeds `capacity`, the record was overwritten while being
+ *     read and the reader resumes from `committed`;
+ *   - otherwise advances P by the record's size.
+ *
+ * The header is valid once `magic` reads PD3_ESTIMATOR_RING_MAGIC.
+ * Readers should check `version` and `key_size` against their own.
+ * `magic`, `reserved` and `committed` change while readers run:
+ * load them atomically, for instance with __atomic_load_n(). */
+#define PD3_ESTIMATOR_RING_MAGIC 0x52334450 /* "PD3R" */
+#define PD3_ESTIMATOR_RING_VERSION 1
+
+typedef struct pd3_estimator_ring_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t key_size;        /* PD3_ESTIMATOR_KEY_SIZE of the writer */
+    uint64_t data_offset;
+    uint64_t capacity;        /* a power of two */
+    uint64_t reserved;
+    uint64_t committed;
+} pd3_estimator_ring_header;
+
+/* Record types */
+#define PD3_ESTIMATOR_RING_PAD 0
+#define PD3_ESTIMATOR_RING_FLOW 1
+#define PD3_ESTIMATOR_RING_REPORT 2
+
+/* Flags of flow records: which results are valid */
+#define PD3_ESTIMATOR_RING_LOSS 0x1
+#define PD3_ESTIMATOR_RING_REORDER_EXTENT 0x2
+#define PD3_ESTIMATOR_RING_REORDER_DENSITY 0x4
+
+/* Common start of all records. `size` counts the whole record, in
+ * bytes, and is a multiple of 8. */
+typedef struct pd3_estimator_ring_record {
+    uint32_t size;
+    uint16_t type;
+    uint16_t flags;
+} pd3_estimator_ring_record;
+
+/* Results of one flow, see pd3_estimator_results. The record is
+ * followed by the non-zero bins of its histograms:
+ * num_extent_bins pd3_estimator_reorder_extent_bin, then
+ * num_density_bins pd3_estimator_reorder_density_bin. */
+typedef struct pd3_estimator_ring_flow {
+    pd3_estimator_ring_record record;
+    uint64_t report;          /* number of the report */
+    TIMESTAMP earliest;
+    TIMESTAMP latest;
+    TIMEINTERVAL duration;
+    SEQNO min_seq;
+    SEQNO max_seq;
+    PACKETCOUNT packet_count;
+    PACKETCOUNT assumed_drops;
+    pd3_estimator_loss_results loss_results;
+    uint32_t num_extent_bins;
+    uint32_t num_density_bins;
+    uint8_t flow_key[PD3_ESTIMATOR_KEY_SIZE];
+} pd3_estimator_ring_flow;
+
+/* Written after the flow records of a report */
+typedef struct pd3_estimator_ring_report {
+    pd3_estimator_ring_record record;
+    uint64_t report;          /* number of the report */
+    TIMEINTERVAL duration;
+    uint64_t flows;           /* number of flow records written */
+} pd3_estimator_ring_report;
+
+/* Layout of the capture file written with the capture_path option:
+ * a header followed by one fixed-size record per packet info pushed,
+ * in the order each handle pushed them. Records of different handles
+ * are interleaved in blocks. */
+#define PD3_ESTIMATOR_CAPTURE_MAGIC 0x43334450 /* "PD3C" */
+#define PD3_ESTIMATOR_CAPTURE_VERSION 1
+
+typedef struct pd3_estimator_capture_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t key_size;        /* PD3_ESTIMATOR_KEY_SIZE of the writer */
+    uint32_t record_size;     /* sizeof(pd3_estimator_capture_record) */
+    uint32_t reserved;
+} pd3_estimator_capture_header;
+
+typedef struct pd3_estimator_capture_record {
+    /* Arrival time, in microseconds since the epoch: the packet
+     * info's own, or the time it was pushed */
+    TIMESTAMP timestamp;
+    SEQNO seq;
+    stream_tuple stream;      /* resolved from the slot if need be */
+} pd3_estimator_capture_record;
+
 /* Opaque handle to the estimator service */
 typedef struct pd3_estimator_handle_s pd3_estimator_handle;
 
@@ -204,7 +370,9 @@ typedef struct pd3_estimator_options {
      * Example:c,5,0;c,5,2.5
      * - invokes the callback ('c') every 2.5 seconds, each report covering 5 seconds
      *
-     * 'c' is the only valid destination at this time.
+     * Valid destinations are 'c', the callbacks, and 'm', the
+     * results ring (see results_ring_path). A report may go to both,
+     * e.g. cm,5,0.
      */
     char *reporter_schedule;
 
@@ -220,6 +388,91 @@ typedef struct pd3_estimator_options {
 
     /* Should the library measure reorder density? */
     bool measure_reorder_density;
+
+    /* Maximum extent value that the reorder extent metric will
+     * consider. Larger extents are capped to it. Histograms are
+     * sized to fit. 0 selects REORDER_MAX_EXTENT. */
+    unsigned int reorder_max_extent;
+
+    /* When non-zero, the reorder extent histogram uses log-linear
+     * bins: extents up to 2^(precision + 1) - 1 get a bin each, and
+     * each further power of two range is split into 2^precision
+     * bins, bounding the relative error of an extent by
+     * 2^-precision. Suits large maximum extents, since the number of
+     * bins grows with the logarithm of the maximum extent. 0 selects
+     * one bin per extent. At most 16. */
+    unsigned int reorder_extent_precision;
+
+    /* Displacement threshold of the reorder density metric. Distance
+     * values go from -reorder_dt to +reorder_dt. 0 selects
+     * REORDER_DT. */
+    unsigned int reorder_dt;
+
+    /* Capacity, in packets, of the lock-free single-producer/
+     * single-consumer ring owned by each handle. When non-zero, each
+     * handle pushes packet meta-data through its own ring, which the
+     * aggregator thread polls, instead of through the queue shared by
+     * all handles; producers then never take a lock on the packet
+     * path. The capacity is rounded up to a power of two. When a ring
+     * is full, pushes fail until the aggregator catches up. 0 selects
+     * the shared queue. */
+    unsigned int ring_size;
+
+    /* Number of aggregator threads. Each aggregator owns a disjoint
+     * shard of the streams, chosen by a hash of the stream tuple, so
+     * ingest scales with the number of aggregators. The reporter
+     * merges the shards' results. 0 is treated as 1. */
+    unsigned int num_aggregators;
+
+    /* Number of threads converting each period's per-stream data in
+     * the Reporter Thread, the Reporter Thread included. Streams are
+     * handed out to the threads in small chunks. 0 is treated as
+     * 1. */
+    unsigned int num_reporter_workers;
+
+    /* Should the reorder histograms in the results list only their
+     * non-zero bins? See pd3_estimator_reorder_extent_results and
+     * pd3_estimator_reorder_density_results. */
+    bool sparse_results;
+
+    /* Maximum number of flows whose latest results are kept for
+     * pd3_estimator_query(). Flows beyond this in a report cannot be
+     * queried. 0 disables queries. */
+    unsigned int snapshot_flows;
+
+    /* File created, or truncated, to hold the results ring of the 'm'
+     * destination of reporter_schedule, see
+     * pd3_estimator_ring_header. Place it on a memory-backed file
+     * system, such as /dev/shm, for consumers to map. NULL disables
+     * the ring, and then the 'm' destination is rejected. */
+    char *results_ring_path;
+
+    /* Size, in bytes, of the record data of the results ring, rounded
+     * up to a power of two. A flow whose record is larger than the
+     * ring is left out of it. 0 selects 1 MiB. */
+    unsigned int results_ring_size;
+
+    /* File created, or truncated, to record every packet info
+     * accepted by the push functions, for replay, see
+     * pd3_estimator_capture_header. Packet infos without a timestamp
+     * are recorded with the time they were pushed. NULL disables
+     * capture. */
+    char *capture_path;
+
+    /* Should the library run on a virtual clock instead of the wall
+     * clock? The virtual clock starts at virtual_clock_start, in
+     * microseconds since the epoch, and only moves forward: to the
+     * latest packet timestamp pushed through a handle when the
+     * handle is flushed, or explicitly with
+     * pd3_estimator_advance_clock(). Aggregation periods then start
+     * at virtual_clock_start and last exactly aggregation_interval;
+     * each packet counts in the period of its timestamp, or in the
+     * current period if that one has already ended. Reports are due
+     * by the end time of the periods they cover. Processing thus runs
+     * as fast as the packets come, and the same packets always give
+     * the same reports. */
+    bool virtual_clock;
+    TIMESTAMP virtual_clock_start;
 } pd3_estimator_options;
 
 /*************************************** API *****************************/
@@ -240,11 +493,50 @@ int pd3_estimator_destroy_handle(pd3_estimator_handle *handle);
 /* Join thread(s), clean up. Returns 0 on success, -1 on error. */
 int pd3_estimator_destroy(void);
 
+/* Register a long-lived stream. Returns a small positive slot that
+ * identifies the stream in the `slot` field of subsequent packet
+ * infos, from any handle, until pd3_estimator_destroy(). Returns -1 on
+ * error. */
+int pd3_estimator_register_stream(pd3_estimator_handle *handle,
+                                  const stream_tuple *stream);
+
 /* Push meta-data about a packet. Returns 0 on success, -1 on error. */
 int pd3_estimator_push_packet_info(pd3_estimator_handle *handle,
                                    pd3_estimator_packet_info *pinfo);
 
+/* Push meta-data about a vector of `n` packets. The packet infos are
+ * copied, so `pinfos` may be reused as soon as the call returns. The
+ * vector is handed to the aggregator in blocks of up to
+ * PD3_ESTIMATOR_BATCH_SIZE packets, each costing a single queue
+ * node. Returns 0 if all `n` were pushed, -1 otherwise.
+ *
+ * The push stops at the first packet info that cannot be pushed: when
+ * a ring is full (see ring_size), or at a slot that was never
+ * registered. The number of packet infos pushed, which are the first
+ * ones of the vector, is stored in `*accepted` unless it is NULL. To
+ * push the rest after a full ring, flush and call again with
+ * `pinfos + *accepted`; skip a packet info with an invalid slot. An
+ * allocation failure also stops the push. */
+int pd3_estimator_push_packet_infos(pd3_estimator_handle *handle,
+                                    const pd3_estimator_packet_info *pinfos,
+                                    size_t n, size_t *accepted);
+
 /* Flush packets to the estimator. Returns 0 on success, -1 on error. */
 int pd3_estimator_flush(pd3_estimator_handle *handle);
 
+/* Move the virtual clock forward to `now`, in microseconds since the
+ * epoch, e.g., to close the periods that follow the last packets, see
+ * pd3_estimator_options.virtual_clock. Returns 0 on success, -1 if the
+ * virtual clock is not in use. */
+int pd3_estimator_advance_clock(TIMESTAMP now);
+
+/* Copy the results of flow `flow_key` from the most recent report
+ * into `results`, without histogram bins: bin pointers are NULL and
+ * num_bins is 0. May be called from any thread, until
+ * pd3_estimator_destroy(), and never blocks the Reporter Thread.
+ * Requires the snapshot_flows option. Returns 0 on success, -1 if
+ * the flow was not in the most recent report or queries are
+ * disabled. */
+int pd3_estimator_query(const uint8_t *flow_key, pd3_estimator_results *results);
+
 #endif /* _PD3_ESTIMATOR_H_ */
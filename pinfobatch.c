@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pinfobatch.h"
+
+struct pinfoBatch *get_pinfobatch(struct pinfoBatchList *freelist)
+{
+    struct pinfoBatch *b;
+
+    if (freelist && freelist->head) {
+        b = freelist->head;
+        freelist->head = b->next;
+        if (b == freelist->tail) {
+            freelist->tail = NULL;
+        }
+        freelist->count--;
+    } else {
+        b = malloc(sizeof(*b));
+        if (!b) {
+            fprintf(stderr, "malloc failed\n");
+            return NULL;
+        }
+    }
+    b->count = 0;
+    b->next = NULL;
+
+    return b;
+}
+
+void put_pinfobatch(struct pinfoBatchList *freelist, struct pinfoBatch *b)
+{
+    b->next = freelist->head;
+    freelist->head = b;
+    if (!freelist->tail) {
+        freelist->tail = b;
+    }
+    freelist->count++;
+}
+
+void move_pinfobatchlist(struct pinfoBatchList *to, struct pinfoBatchList *from)
+{
+    if (!from->head) {
+        return;    /* nothing to move */
+    } else if (!to->head) {    /* replace */
+        to->head = from->head;
+        to->tail = from->tail;
+    } else {    /* append */
+        to->tail->next = from->head;
+        to->tail = from->tail;
+    }
+    to->count += from->count;
+    from->count = 0;
+    from->head = NULL;
+    from->tail = NULL;
+}
+
+void free_pinfobatchlist(struct pinfoBatchList *l)
+{
+    struct pinfoBatch *b;
+
+    if (!l) {
+        return;
+    }
+
+    b = l->head;
+    while (b) {
+        struct pinfoBatch *victim;
+        victim = b;
+        b = b->next;
+        free(victim);
+    }
+    l->count = 0;
+    l->head = NULL;
+    l->tail = NULL;
+}
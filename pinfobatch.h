@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_PINFOBATCH_H_
+#define _PD3_ESTIMATOR_PINFOBATCH_H_
+
+#include "pd3_estimator.h"
+
+/* A vector of packet infos, copied by value, that travels from a
+ * client handle to the aggregator as a single fistq node. Spent
+ * batches are recycled through free lists rather than freed. */
+struct pinfoBatch {
+    unsigned int count;
+    struct pinfoBatch *next;
+    pd3_estimator_packet_info pinfo[PD3_ESTIMATOR_BATCH_SIZE];
+};
+
+struct pinfoBatchList {
+    unsigned int count;
+    struct pinfoBatch *head;
+    struct pinfoBatch *tail;
+};
+
+/* Returns a batch from the free list, or a freshly allocated one if
+ * the free list is empty. Returns NULL on error. */
+struct pinfoBatch *get_pinfobatch(struct pinfoBatchList *freelist);
+void put_pinfobatch(struct pinfoBatchList *freelist, struct pinfoBatch *b);
+void move_pinfobatchlist(struct pinfoBatchList *to, struct pinfoBatchList *from);
+void free_pinfobatchlist(struct pinfoBatchList *l);
+
+#endif /* _PD3_ESTIMATOR_PINFOBATCH_H_ */
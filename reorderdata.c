@@ -31,30 +31,133 @@
 static bool reorder_extent_enabled = true;
 static bool reorder_density_enabled = true;
 
+/* Configured limits, and the sizes derived from them */
+static unsigned int max_extent = REORDER_MAX_EXTENT;
+static unsigned int dt = REORDER_DT;
+static unsigned int extent_precision;  /* 0 for one bin per extent */
+static unsigned int extent_bins;       /* reported extent bins */
+static unsigned int max_history;       /* 2 * max_extent */
+static unsigned int history_size;      /* slots of a missing packet history */
+static unsigned int window_capacity;   /* DT + 1 */
+static unsigned int window_set_size;   /* slots of the window set */
+static unsigned int window_set_words;
+static unsigned int buffer_words;
+
 /* Returns 0 on success, -1 on error */
-int reorderdata_init(bool measure_reorder_extent, bool measure_reorder_density)
+int reorderdata_init(bool measure_reorder_extent, bool measure_reorder_density,
+                     unsigned int extent, unsigned int distance,
+                     unsigned int precision)
 {
+    if (precision > REORDER_MAX_EXTENT_PRECISION) {
+        return -1;
+    }
+
     reorder_extent_enabled = measure_reorder_extent;
     reorder_density_enabled = measure_reorder_density;
 
+    max_extent = extent;
+    dt = distance;
+    extent_precision = precision;
+    /* Bins for extents 0 to max_extent - 1; capped extents go to an
+     * extra, unreported bin */
+    extent_bins = reorderdata_extent_bin(max_extent - 1) + 1;
+    max_history = max_extent * 2;
+    history_size = max_history + 1;
+    window_capacity = dt + 1;
+    window_set_size = window_capacity * 2;
+    window_set_words = RD_BITSET_WORDS(window_set_size);
+    buffer_words = RD_BITSET_WORDS(dt + 1);
+
     return 0;
 }
 
+unsigned int reorderdata_max_extent(void)
+{
+    return max_extent;
+}
+
+unsigned int reorderdata_dt(void)
+{
+    return dt;
+}
+
+/* Log-linear bucketing: extents below 2^(precision + 1) get a bin
+ * each, and every further power of two range is split into
+ * 2^precision bins of equal width. */
+unsigned int reorderdata_extent_bin(unsigned int extent)
+{
+    unsigned int sub_bins = 1u << extent_precision;
+    unsigned int magnitude;
+
+    if (extent_precision == 0 || extent < 2 * sub_bins) {
+        return extent;
+    }
+    /* extent lies in [2^magnitude, 2^(magnitude + 1)) */
+    magnitude = 31 - __builtin_clz(extent);
+    return ((magnitude - extent_precision + 1) << extent_precision) +
+        (extent >> (magnitude - extent_precision)) - sub_bins;
+}
+
+void reorderdata_extent_bin_bounds(unsigned int bin, uint32_t *low, uint32_t *high)
+{
+    unsigned int sub_bins = 1u << extent_precision;
+    unsigned int shift;
+
+    if (extent_precision == 0 || bin < 2 * sub_bins) {
+        *low = *high = bin;
+    }
+    else {
+        shift = (bin >> extent_precision) - 1;
+        *low = (sub_bins + (bin & (sub_bins - 1))) << shift;
+        *high = *low + (1u << shift) - 1;
+    }
+    if (*high > max_extent - 1) {
+        *high = max_extent - 1;
+    }
+}
+
+unsigned int reorderdata_num_extent_bins(void)
+{
+    return extent_bins;
+}
+
+size_t reorderdata_size(void)
+{
+    return sizeof(struct reorderDataR) +
+        (extent_bins + 1 + 2 * dt + 1) * sizeof(PACKETCOUNT);
+}
+
+PACKETCOUNT *reorderdata_extents(struct reorderDataR *dr)
+{
+    return dr->bins;
+}
+
+PACKETCOUNT *reorderdata_fd(struct reorderDataR *dr)
+{
+    return dr->bins + extent_bins + 1;
+}
+
 static void reorderdata_accumulate(struct reorderDataR *accum,
                                    struct reorderDataR *unit)
 {
     if (reorder_extent_enabled) {
+        PACKETCOUNT *to = reorderdata_extents(accum);
+        PACKETCOUNT *from = reorderdata_extents(unit);
+
         /* Combine histogram buckets */
-        for (int i = 0; i < REORDER_MAX_EXTENT; i++) {
-            accum->extentToCount[i] += unit->extentToCount[i];
+        for (unsigned int i = 0; i < extent_bins; i++) {
+            to[i] += from[i];
         }
         /* Sum the assumed drops */
         accum->extent_assumed_drops += unit->extent_assumed_drops;
     }
 
     if (reorder_density_enabled) {
-        for (int i = 0; i < REORDER_WINDOW_SIZE; i++) {
-            accum->FD[i] += unit->FD[i];
+        PACKETCOUNT *to = reorderdata_fd(accum);
+        PACKETCOUNT *from = reorderdata_fd(unit);
+
+        for (unsigned int i = 0; i < 2 * dt + 1; i++) {
+            to[i] += from[i];
         }
         /* Sum the assumed drops */
         accum->rd_assumed_drops += unit->rd_assumed_drops;
@@ -71,111 +174,158 @@ void reorderdata_accumulate_flows(struct reorderDataR *accum, struct reorderData
     reorderdata_accumulate(accum, unit);
 }
 
-/* Since we're just looking for the sequence number, we can use a
- * plain old comparison function and don't need to worry about
- * wraparound. */
-static int mp_compare(const void *key, const RBTreeNode *node)
+/* Allocate a stream's reorder density state, with its arrays */
+static struct rdState *rd_create(void)
 {
-    struct reorderMissingPacket *mp;
-    SEQNO seq;
-
-    seq = *(SEQNO *)key;
-    mp = rbtree_entry(node, struct reorderMissingPacket, n);
+    struct rdState *state;
+    size_t size;
 
-    if (seq < mp->seq) {
-        return -1;
+    size = sizeof(*state) +
+        (window_set_words + buffer_words) * sizeof(uint64_t) +
+        (window_capacity * 2 + window_set_size) * sizeof(SEQNO);
+    state = calloc(1, size);
+    if (!state) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
     }
 
-    if (seq > mp->seq) {
-        return 1;
-    }
+    state->window_set_used = (uint64_t *) (state + 1);
+    state->buffer = state->window_set_used + window_set_words;
+    state->window = (SEQNO *) (state->buffer + buffer_words);
+    state->window_min = state->window + window_capacity;
+    state->window_set = state->window_min + window_capacity;
 
-    return 0;
+    return state;
 }
 
-/* Since we're just looking for the sequence number, we can use a
- * plain old comparison function and don't need to worry about
- * wraparound. */
-static int buffer_compare(const void *key, const RBTreeNode *node)
+static int rd_bit_test(const uint64_t *bits, unsigned int i)
 {
-    SEQNO seq;
-    struct rdBufferEntry *be;
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
 
-    seq = *(SEQNO *)key;
-    be = rbtree_entry(node, struct rdBufferEntry, n);
+static void rd_bit_set(uint64_t *bits, unsigned int i)
+{
+    bits[i / 64] |= (uint64_t)1 << (i % 64);
+}
 
-    if (seq < be->seq) {
-        return -1;
-    }
+static void rd_bit_clear(uint64_t *bits, unsigned int i)
+{
+    bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
 
-    if (seq > be->seq) {
-        return 1;
+/* Slot of `seq` in the window set, or -1 if absent */
+static int rd_window_find(struct rdState *state, SEQNO seq)
+{
+    unsigned int i = seq % window_set_size;
+
+    while (rd_bit_test(state->window_set_used, i)) {
+        if (state->window_set[i] == seq) {
+            return i;
+        }
+        i = (i + 1) % window_set_size;
     }
 
-    return 0;
+    return -1;
 }
 
-static int rd_maybe_add_seq_to_window(struct rdState *RD, SEQNO i)
+static void rd_window_set_insert(struct rdState *state, SEQNO seq)
 {
-    QueueNode *cursor;
-    struct rdWindowEntry *e;
+    unsigned int i = seq % window_set_size;
 
-    queue_for_each(cursor, &RD->window) {
-        e = queue_entry(cursor, struct rdWindowEntry, n);
-        /* Don't add a duplicate. Return the old size. */
-        if (e->seq == i) {
-            return queue_size(&RD->window);
-        }
+    while (rd_bit_test(state->window_set_used, i)) {
+        i = (i + 1) % window_set_size;
     }
+    state->window_set[i] = seq;
+    rd_bit_set(state->window_set_used, i);
+}
 
-    e = malloc(sizeof(*e));
-    if (!e) {
-        fprintf(stderr, "malloc failed\n");
-        return -1;
+/* Remove `seq` from the window set, shifting back the entries that
+ * probed past its slot so that lookups never stop early. */
+static void rd_window_set_remove(struct rdState *state, SEQNO seq)
+{
+    int found = rd_window_find(state, seq);
+    unsigned int hole, i, home;
+
+    if (found < 0) {
+        return;
     }
-    e->seq = i;
-    queue_push(&RD->window, &e->n);
 
-    return queue_size(&RD->window);
+    hole = found;
+    rd_bit_clear(state->window_set_used, hole);
+    for (i = (hole + 1) % window_set_size;
+         rd_bit_test(state->window_set_used, i);
+         i = (i + 1) % window_set_size) {
+        home = state->window_set[i] % window_set_size;
+        /* Leave the entry if its home lies cyclically in (hole, i] */
+        if ((hole < i) ? (home > hole && home <= i) : (home > hole || home <= i)) {
+            continue;
+        }
+        state->window_set[hole] = state->window_set[i];
+        rd_bit_set(state->window_set_used, hole);
+        rd_bit_clear(state->window_set_used, i);
+        hole = i;
+    }
 }
 
 static int rd_window_contains(struct rdState *state, SEQNO seq)
 {
-    QueueNode *cursor;
+    return rd_window_find(state, seq) >= 0;
+}
 
-    queue_for_each(cursor, &state->window) {
-        struct rdWindowEntry *e = queue_entry(cursor, struct rdWindowEntry, n);
-        if (e->seq == seq) {
-            return 1;
+static void rd_window_push(struct rdState *state, SEQNO seq)
+{
+    unsigned int tail;
+
+    tail = (state->window_head + state->window_size) % window_capacity;
+    state->window[tail] = seq;
+    state->window_size++;
+    rd_window_set_insert(state, seq);
+
+    /* Larger sequence numbers can no longer be the window minimum */
+    while (state->window_min_size > 0) {
+        tail = (state->window_min_head + state->window_min_size - 1) % window_capacity;
+        if (state->window_min[tail] <= seq) {
+            break;
         }
+        state->window_min_size--;
     }
-
-    return 0;
+    tail = (state->window_min_head + state->window_min_size) % window_capacity;
+    state->window_min[tail] = seq;
+    state->window_min_size++;
 }
 
-static int rd_buffer_contains(struct rdState *state, SEQNO seq)
+/* Remove and return the oldest window entry */
+static SEQNO rd_window_pop(struct rdState *state)
 {
-    if (rbtree_lookup_key(&state->buffer, &seq)) {
-        return 1;
+    SEQNO seq = state->window[state->window_head];
+
+    state->window_head = (state->window_head + 1) % window_capacity;
+    state->window_size--;
+    rd_window_set_remove(state, seq);
+
+    if (state->window_min_size > 0 && state->window_min[state->window_min_head] == seq) {
+        state->window_min_head = (state->window_min_head + 1) % window_capacity;
+        state->window_min_size--;
     }
 
-    return 0;
+    return seq;
 }
 
-static int rd_add_seq_to_window(struct rdState *RD, SEQNO i)
+static int rd_maybe_add_seq_to_window(struct rdState *RD, SEQNO i)
 {
-    struct rdWindowEntry *e;
-
-    e = malloc(sizeof(*e));
-    if (!e) {
-        fprintf(stderr, "malloc failed\n");
-        return -1;
+    /* Don't add a duplicate. Return the old size. */
+    if (!rd_window_contains(RD, i)) {
+        rd_window_push(RD, i);
     }
 
-    e->seq = i;
-    queue_push(&RD->window, &e->n);
+    return RD->window_size;
+}
 
-    return 0;
+static int rd_buffer_contains(struct rdState *state, SEQNO seq)
+{
+    SEQNO offset = seq - state->RI;
+
+    return offset <= dt && rd_bit_test(state->buffer, offset);
 }
 
 static void rd_maybe_add_new_arrival_to_window(struct rdState *state, SEQNO seq)
@@ -188,15 +338,15 @@ static void rd_maybe_add_new_arrival_to_window(struct rdState *state, SEQNO seq)
     if (seq >= state->RI &&
         !rd_window_contains(state, seq) &&
         !rd_buffer_contains(state, seq)) {
-        rd_add_seq_to_window(state, seq);
+        rd_window_push(state, seq);
         state->state = 0;
     }
 }
 
 static void rd_record_distance(struct reorderDataR *dr, ReorderDistance D)
 {
-    static int lower = REORDER_DT * -1;
-    static int upper = REORDER_DT;
+    int lower = -(int) dt;
+    int upper = dt;
     int index;
 
     if (D < lower || D > upper) {
@@ -204,68 +354,74 @@ static void rd_record_distance(struct reorderDataR *dr, ReorderDistance D)
     }
 
     // lower maps to 0
-    // upper maps to REORDER_DT * 2
-    index = D + REORDER_DT;
-    dr->FD[index]++;
+    // upper maps to dt * 2
+    index = D + dt;
+    reorderdata_fd(dr)[index]++;
 }
 
 static void rd_maybe_delete_from_buffer(struct rdState *state, SEQNO seq)
 {
-    RBTreeNode *n;
+    SEQNO offset = seq - state->RI;
 
-    n = rbtree_lookup_key(&state->buffer, &seq);
-    if (n) {
-        struct rdBufferEntry *e = rbtree_entry(n, struct rdBufferEntry, n);
-        rbtree_remove(&state->buffer, n);
-        free(e);
+    if (offset <= dt) {
+        rd_bit_clear(state->buffer, offset);
     }
 }
 
-static int rd_add_to_buffer(struct rdState *state, SEQNO seq)
+static void rd_add_to_buffer(struct rdState *state, SEQNO seq)
 {
-    struct rdBufferEntry *e;
+    SEQNO offset = seq - state->RI;
 
-    e = malloc(sizeof(*e));
-    if (!e) {
-        fprintf(stderr, "malloc failed\n");
-        return -1;
+    if (offset <= dt) {
+        rd_bit_set(state->buffer, offset);
     }
-
-    e->seq = seq;
-    rbtree_insert(&state->buffer, &e->seq, &e->n);
-
-    return 0;
 }
 
 static SEQNO rd_window_min(struct rdState *state)
 {
-    QueueNode *cursor;
-    struct rdWindowEntry *e;
-    SEQNO min = (SEQNO)-1;
+    if (state->window_min_size == 0) {
+        return (SEQNO)-1;
+    }
+
+    return state->window_min[state->window_min_head];
+}
 
-    queue_for_each(cursor, &state->window) {
-        e = queue_entry(cursor, struct rdWindowEntry, n);
-        if (e->seq < min) {
-            min = e->seq;
+static SEQNO rd_buffer_min(struct rdState *state)
+{
+    for (unsigned int i = 0; i < buffer_words; i++) {
+        if (state->buffer[i]) {
+            return state->RI + i * 64 + __builtin_ctzll(state->buffer[i]);
         }
     }
 
-    return min;
+    return (SEQNO)-1;
 }
 
-static SEQNO rd_buffer_min(struct rdState *state)
+/* Move RI forward, shifting the buffer so that it stays relative to
+ * RI */
+static void rd_set_RI(struct rdState *state, SEQNO RI)
 {
-    RBTreeNode *n;
-    struct rdBufferEntry *e;
-    SEQNO min = (SEQNO)-1;
+    const unsigned int words = buffer_words;
+    SEQNO shift = RI - state->RI;
 
-    n = rbtree_first(&state->buffer);
-    if (n) {
-        e = rbtree_entry(n, struct rdBufferEntry, n);
-        min = e->seq;
+    state->RI = RI;
+
+    if (shift > dt) {
+        memset(state->buffer, 0, buffer_words * sizeof(uint64_t));
+        return;
     }
 
-    return min;
+    for (unsigned int i = 0; i < words; i++) {
+        unsigned int src = i + shift / 64;
+        uint64_t v = 0;
+        if (src < words) {
+            v = state->buffer[src] >> (shift % 64);
+            if (shift % 64 && src + 1 < words) {
+                v |= state->buffer[src + 1] << (64 - shift % 64);
+            }
+        }
+        state->buffer[i] = v;
+    }
 }
 
 static void rd_advance_RI(struct rdState *state, struct reorderDataR *dr)
@@ -278,10 +434,10 @@ static void rd_advance_RI(struct rdState *state, struct reorderDataR *dr)
 
     m = (s1 <= s2) ? s1 : s2;
     if (state->RI < m) {
-        state->RI = m;
+        rd_set_RI(state, m);
     }
     else {
-        state->RI++;
+        rd_set_RI(state, state->RI + 1);
     }
 }
 
@@ -289,24 +445,22 @@ static void rd_process_next_packet(struct rdState *state, struct reorderDataR *d
 {
     if (rd_window_contains(state, state->RI) || rd_buffer_contains(state, state->RI)) {
         ReorderDistance D, AD;
-        QueueNode *qn = queue_pop(&state->window);
-        struct rdWindowEntry *e = queue_entry(qn, struct rdWindowEntry, n);
-        D = state->RI - e->seq;
+        SEQNO seq = rd_window_pop(state);
+        D = state->RI - seq;
         AD = (D >= 0) ? D : -D;
 
         /* Displacement within threshold */
-        if (AD <= REORDER_DT) {
+        if (AD <= (int) dt) {
             rd_record_distance(dr, D);
             rd_maybe_delete_from_buffer(state, state->RI);
             if (D < 0) {
-                rd_add_to_buffer(state, e->seq);
+                rd_add_to_buffer(state, seq);
             }
-            state->RI++;
+            rd_set_RI(state, state->RI + 1);
         }
         /* Displacement beyond threshold */
         else {
         }
-        free(e);
 
         /* Signal that we're looking for the next arrival */
         state->state = 1;
@@ -318,23 +472,226 @@ static void rd_process_next_packet(struct rdState *state, struct reorderDataR *d
     }
 }
 
-static int reorderdata_record_missing_packet(struct reorderState *rstate,
-                                             SEQNO seq, PACKETCOUNT refIndex)
+/* Is the window in a steady in-order state, with `seq` the next
+ * packet in sequence? The window then holds RI, RI + 1, ... up to the
+ * newest arrival, in arrival order, and the buffer is empty. Each
+ * in-order arrival from there records a distance of 0 and slides the
+ * window by one.
+ *
+ * At most one sequence number in that span may be absent from the
+ * window: an arrival that came while RI was being advanced past a
+ * dropped packet is never added to the window. Such a hole is returned
+ * in `hole`. When RI reaches it, RI skips it and the current arrival
+ * becomes the next hole. */
+static int rd_in_order(struct rdState *state, SEQNO seq, int *has_hole, SEQNO *hole)
+{
+    unsigned int size = state->window_size;
+    unsigned int lo, hi;
+    SEQNO back;
+
+    if (size == 0 || size != (state->state == 0 ? dt + 1 : dt)) {
+        return 0;
+    }
+
+    /* Only an ascending window keeps every entry as a minimum candidate */
+    if (state->window_min_size != size) {
+        return 0;
+    }
+
+    /* Arrivals are compared with RI without wraparound, so a run past
+     * sequence number 0 takes the slow path */
+    if (state->window[state->window_head] != state->RI || seq <= state->RI) {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < buffer_words; i++) {
+        if (state->buffer[i]) {
+            return 0;
+        }
+    }
+
+    back = state->window[(state->window_head + size - 1) % window_capacity];
+
+    if (seq - state->RI == size && back == seq - 1) {
+        *has_hole = 0;
+        *hole = 0;
+        return 1;
+    }
+
+    /* A hole only arises while looking for the next window item */
+    if (state->state != 0 || seq - state->RI != size + 1) {
+        return 0;
+    }
+
+    *has_hole = 1;
+    if (back == seq - 2) {
+        *hole = seq - 1;
+        return 1;
+    }
+    if (back != seq - 1) {
+        return 0;
+    }
+
+    /* Bisect for the first window entry past the hole */
+    lo = 0;
+    hi = size - 1;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (state->window[(state->window_head + mid) % window_capacity] == state->RI + mid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *hole = state->RI + lo;
+
+    return 1;
+}
+
+/* Account the `count` in-order arrivals starting at `seq` at once.
+ * Assumes rd_in_order() holds for `seq`, and that the run does not
+ * wrap. */
+static void rd_process_in_order_run(struct rdState *state, struct reorderDataR *dr,
+                                    SEQNO seq, PACKETCOUNT count,
+                                    int has_hole, SEQNO hole)
+{
+    unsigned int size = state->window_size;
+    SEQNO next = seq;
+    PACKETCOUNT k;
+
+    if (!has_hole) {
+        reorderdata_fd(dr)[dt] += count;
+        state->RI += count;
+        next += count;
+    }
+    else {
+        /* Arrivals up to the hole each pop RI */
+        k = (count < hole - state->RI) ? count : hole - state->RI;
+        reorderdata_fd(dr)[dt] += k;
+        state->RI += k;
+        next += k;
+        count -= k;
+
+        if (count > 0) {
+            /* RI skips the hole, and the arrival becomes the next one.
+             * From there, each cycle of size + 1 arrivals pops size
+             * entries and skips one hole. */
+            state->RI = hole + 1;
+            hole = next++;
+            count--;
+
+            reorderdata_fd(dr)[dt] += (count / (size + 1)) * size + count % (size + 1);
+            state->RI += count / (size + 1) * (size + 1) + count % (size + 1);
+            hole += count / (size + 1) * (size + 1);
+            next += count;
+        }
+    }
+
+    /* Rebuild the window from the newest arrivals */
+    state->window_head = 0;
+    state->window_size = 0;
+    state->window_min_head = 0;
+    state->window_min_size = 0;
+    memset(state->window_set_used, 0, window_set_words * sizeof(uint64_t));
+    for (SEQNO i = state->RI; i != next; i++) {
+        if (!has_hole || i != hole) {
+            rd_window_push(state, i);
+        }
+    }
+}
+
+static int reorderdata_missing_packet_expired(struct reorderState *rstate, SEQNO seq)
+{
+    return (seqcmp(seq, rstate->nextExp) < 0) &&
+        (modular_distance(seq, rstate->nextExp) > max_history);
+}
+
+/* Slot holding `seq`, or -1 if the history does not cover it */
+static int reorderdata_history_slot(struct reorderHistory *h, SEQNO seq)
 {
-    struct reorderMissingPacket *mp;
+    SEQNO offset = seq - h->base;
 
-    mp = malloc(sizeof(*mp));
-    if (!mp) {
-        fprintf(stderr, "malloc failed\n");
+    if (offset >= history_size) {
         return -1;
     }
 
-    mp->seq = seq;
-    mp->observed = 0;
-    mp->refIndex = refIndex;
-    mp->extent = -1;
+    return (h->head + offset) % history_size;
+}
 
-    rbtree_insert(&rstate->missingPackets, &mp->seq, &mp->n);
+/* Move the start of the history forward to `base`, declaring the
+ * missing packets that fall out of it as dropped. */
+static void reorderdata_history_advance(struct reorderDataR *dr,
+                                        struct reorderHistory *h, SEQNO base)
+{
+    SEQNO distance = base - h->base;
+
+    if (h->count == 0) {
+        /* Nothing to clear */
+    }
+    else if (distance >= history_size) {
+        for (unsigned int i = 0; i < history_size; i++) {
+            if (h->state[i] == REORDER_SLOT_MISSING) {
+                dr->extent_assumed_drops++;
+            }
+        }
+        memset(h->state, REORDER_SLOT_NONE, history_size);
+        h->count = 0;
+    }
+    else {
+        for (SEQNO i = 0; i < distance; i++) {
+            unsigned int slot = (h->head + i) % history_size;
+            if (h->state[slot] == REORDER_SLOT_MISSING) {
+                dr->extent_assumed_drops++;
+            }
+            if (h->state[slot] != REORDER_SLOT_NONE) {
+                h->state[slot] = REORDER_SLOT_NONE;
+                h->count--;
+            }
+        }
+    }
+
+    h->head = (h->head + distance % history_size) % history_size;
+    h->base = base;
+}
+
+/* Record the packets from `low` up to, but excluding, `end` as
+ * missing. Only the newest history_size of them are kept. */
+static int reorderdata_record_missing_packets(struct reorderDataR *dr,
+                                              struct reorderState *rstate,
+                                              SEQNO low, SEQNO end,
+                                              PACKETCOUNT refIndex)
+{
+    struct reorderHistory *h = rstate->missingPackets;
+
+    if (!h) {
+        h = calloc(1, sizeof(*h) + history_size * (sizeof(PACKETCOUNT) + 1));
+        if (!h) {
+            fprintf(stderr, "calloc failed\n");
+            return -1;
+        }
+        h->refIndex = (PACKETCOUNT *) (h + 1);
+        h->state = (uint8_t *) (h->refIndex + history_size);
+        h->base = low;
+        rstate->missingPackets = h;
+    }
+
+    if ((SEQNO)(end - h->base) > history_size) {
+        reorderdata_history_advance(dr, h, end - history_size);
+    }
+
+    if (seqcmp(low, h->base) < 0) {
+        dr->extent_assumed_drops += h->base - low;
+        low = h->base;
+    }
+
+    for (SEQNO seq = low; seq != end; seq++) {
+        int slot = reorderdata_history_slot(h, seq);
+        if (h->state[slot] == REORDER_SLOT_NONE) {
+            h->count++;
+        }
+        h->state[slot] = REORDER_SLOT_MISSING;
+        h->refIndex[slot] = refIndex;
+    }
 
     return 0;
 }
@@ -345,31 +702,35 @@ static void reorderdata_resolve_missing_packet(struct reorderDataR *dr,
                                                struct reorderState *rstate,
                                                SEQNO seq)
 {
-    RBTreeNode *node;
-    struct reorderMissingPacket *mp;
+    struct reorderHistory *h = rstate->missingPackets;
     PACKETCOUNT arrivalIndex;
+    int slot;
 
-    node = rbtree_lookup_key(&rstate->missingPackets, &seq);
-    if (!node) {
+    if (!h || (slot = reorderdata_history_slot(h, seq)) < 0) {
         return;
     }
-    mp = rbtree_entry(node, struct reorderMissingPacket, n);
 
     arrivalIndex = rstate->numArrivals;
 
-    if (!mp->observed) {
+    if (h->state[slot] == REORDER_SLOT_MISSING) {
         /* Compute the extent, capped at the configured maximum */
-        int extent = arrivalIndex - mp->refIndex;
-        if (extent > REORDER_MAX_EXTENT) {
+        int extent = arrivalIndex - h->refIndex[slot];
+        unsigned int bin;
+        if (extent >= (int) max_extent) {
 #ifdef REORDER_DEBUG
-            fprintf(stderr, "Capping real extent %d to %d\n", extent, REORDER_MAX_EXTENT);
+            if (extent > (int) max_extent) {
+                fprintf(stderr, "Capping real extent %d to %u\n", extent, max_extent);
+            }
 #endif
-            extent = REORDER_MAX_EXTENT;
+            bin = extent_bins;
+        }
+        else {
+            bin = reorderdata_extent_bin(extent);
         }
-        mp->observed = 1;
-        dr->extentToCount[extent]++;
+        h->state[slot] = REORDER_SLOT_OBSERVED;
+        reorderdata_extents(dr)[bin]++;
     }
-    else {
+    else if (h->state[slot] == REORDER_SLOT_OBSERVED) {
         rstate->numArrivals--;
     }
 }
@@ -377,20 +738,20 @@ static void reorderdata_resolve_missing_packet(struct reorderDataR *dr,
 static void reorderdata_prune_missing_packets(struct reorderDataR *dr,
                                               struct reorderState *rstate)
 {
-    RBTreeNode *cursor, *backup;
+    struct reorderHistory *h = rstate->missingPackets;
+    SEQNO keep;
 
-    rbtree_for_each_safe(cursor, backup, &rstate->missingPackets) {
-        struct reorderMissingPacket *mp;
-        mp = rbtree_entry(cursor, struct reorderMissingPacket, n);
-        if ((seqcmp(mp->seq, rstate->nextExp) < 0) &&
-            (modular_distance(mp->seq, rstate->nextExp) > REORDER_MAX_HISTORY)) {
-            if (!mp->observed) {
-                dr->extent_assumed_drops += 1;
-            }
-            rbtree_remove(&rstate->missingPackets, cursor);
-            free(mp);
-        }
+    if (!h || !reorderdata_missing_packet_expired(rstate, h->base)) {
+        return;
+    }
+
+    /* First packet to keep */
+    keep = rstate->nextExp - max_history - 1;
+    if (reorderdata_missing_packet_expired(rstate, keep)) {
+        keep++;
     }
+
+    reorderdata_history_advance(dr, h, keep);
 }
 
 void reorderdata_a2r(struct reorderDataR *dr, struct reorderDataA *da,
@@ -417,19 +778,17 @@ void reorderdata_a2r(struct reorderDataR *dr, struct reorderDataA *da,
 
         /* Special case of first packet */
         if (!rstate->initialized) {
-            /* EXTENT: initialize nextExp and missingPackets */
+            /* EXTENT: initialize nextExp */
             if (reorder_extent_enabled) {
                 rstate->nextExp = r->low;
-                rbtree_init(&rstate->missingPackets, mp_compare, NULL, NULL);
             }
 
             /* RD */
             if (reorder_density_enabled) {
-                rstate->RD.state = 0;
-                rstate->RD.window_initialized = 0;
-                rstate->RD.RI = 0;
-                queue_init(&rstate->RD.window);
-                rbtree_init(&rstate->RD.buffer, buffer_compare, NULL, NULL);
+                rstate->RD = rd_create();
+                if (!rstate->RD) {
+                    return;
+                }
             }
 
             rstate->initialized = 1;
@@ -437,44 +796,51 @@ void reorderdata_a2r(struct reorderDataR *dr, struct reorderDataA *da,
 
         if (reorder_density_enabled) {
             /* Update reorder distances */
-            for (SEQNO i = r->low; i <= r->high; i++) {
+            for (SEQNO i = r->low; i - r->low < range_size; i++) {
                 int processed_this = 0;
+                int has_hole;
+                SEQNO hole;
 
                 /* Try to initialize the window if not already initialized */
-                if (!rstate->RD.window_initialized) {
-                    int num_unique = rd_maybe_add_seq_to_window(&rstate->RD, i);
-                    /* Something went terribly wrong */
-                    if (num_unique == -1) {
-                        return;
-                    }
-
-                    if (num_unique == REORDER_DT + 1) {
-                        rstate->RD.RI = 0;
-                        rstate->RD.window_initialized = 1;
+                if (!rstate->RD->window_initialized) {
+                    int num_unique = rd_maybe_add_seq_to_window(rstate->RD, i);
+                    if ((unsigned int) num_unique == dt + 1) {
+                        rstate->RD->RI = 0;
+                        rstate->RD->window_initialized = 1;
                     }
                 }
 
                 /* Window not yet initialized. Move along. */
-                if (!rstate->RD.window_initialized) {
+                if (!rstate->RD->window_initialized) {
                     continue;
                 }
 
+                /* The rest of the range is in order: skip ahead,
+                 * unless the range is too short to be worth
+                 * rebuilding the window */
+                if (range_size - (i - r->low) > window_capacity &&
+                    rd_in_order(rstate->RD, i, &has_hole, &hole)) {
+                    rd_process_in_order_run(rstate->RD, dr, i, range_size - (i - r->low),
+                                            has_hole, hole);
+                    break;
+                }
+
                 /* We're still looking for a new window item. Try to add
                  * this seq. */
-                if (rstate->RD.state == 1) {
-                    rd_maybe_add_new_arrival_to_window(&rstate->RD, i);
+                if (rstate->RD->state == 1) {
+                    rd_maybe_add_new_arrival_to_window(rstate->RD, i);
                     processed_this = 1;
                 }
 
                 /* Process one window item if we're in the right state */
-                if (rstate->RD.state == 0) {
-                    rd_process_next_packet(&rstate->RD, dr);
+                if (rstate->RD->state == 0) {
+                    rd_process_next_packet(rstate->RD, dr);
                 }
 
                 /* We're looking for a new window item. Try to add
                  * this seq. */
-                if (rstate->RD.state == 1 && !processed_this) {
-                    rd_maybe_add_new_arrival_to_window(&rstate->RD, i);
+                if (rstate->RD->state == 1 && !processed_this) {
+                    rd_maybe_add_new_arrival_to_window(rstate->RD, i);
                 }
             }
         }
@@ -486,14 +852,12 @@ void reorderdata_a2r(struct reorderDataR *dr, struct reorderDataA *da,
              * range. */
             if (seqcmp(r->low, rstate->nextExp) >= 0) {
                 if (seqcmp(r->low, rstate->nextExp) > 0) {
-                    PACKETCOUNT refIndex = rstate->numArrivals + 1;
-                    for (SEQNO i = rstate->nextExp; i != r->low; i++) {
-                        reorderdata_record_missing_packet(rstate, i, refIndex);
-                    }
+                    reorderdata_record_missing_packets(dr, rstate, rstate->nextExp, r->low,
+                                                       rstate->numArrivals + 1);
                 }
                 rstate->nextExp = (r->high + 1);
                 rstate->numArrivals += range_size;
-                dr->extentToCount[0] += range_size;
+                reorderdata_extents(dr)[0] += range_size;
                 continue;
             }
 
@@ -502,12 +866,12 @@ void reorderdata_a2r(struct reorderDataR *dr, struct reorderDataA *da,
              * missing and already observed, then ignore as duplicate. If
              * the packet is missing but not yet observed, then mark it as
              * observed and compute the extent. Update the histogram. */
-            for (SEQNO i = r->low; i <= r->high; i++) {
+            for (SEQNO i = r->low; i - r->low < range_size; i++) {
                 rstate->numArrivals++;
                 /* Packet is in order */
                 if (seqcmp(i, rstate->nextExp) >= 0) {
                     rstate->nextExp = i + 1;
-                    dr->extentToCount[0]++;
+                    reorderdata_extents(dr)[0]++;
                 }
                 /* Packet is reordered */
                 else {
@@ -560,38 +924,8 @@ int reorderdata_arrival(struct reorderDataA *rd, SEQNO seqno, struct seqnoRangeL
     return 0;
 }
 
-void reorderdata_destroy_missing_packets(RBTree *missingPackets)
-{
-    RBTreeNode *cursor, *backup;
-
-    rbtree_for_each_safe(cursor, backup, missingPackets) {
-        struct reorderMissingPacket *mp;
-        mp = rbtree_entry(cursor, struct reorderMissingPacket, n);
-        rbtree_remove(missingPackets, cursor);
-        free(mp);
-    }
-}
-
-void reorderdata_destroy_rd_buffer(RBTree *buffer)
-{
-    RBTreeNode *cursor, *backup;
-
-    rbtree_for_each_safe(cursor, backup, buffer) {
-        struct rdBufferEntry *entry = rbtree_entry(cursor, struct rdBufferEntry, n);
-        rbtree_remove(buffer, cursor);
-        free(entry);
-    }
-}
-
-void reorderdata_destroy_rd_window(Queue *window)
+void reorderdata_destroy_state(struct reorderState *rstate)
 {
-    if (!window) {
-        return;
-    }
-
-    while (!queue_empty(window)) {
-        QueueNode *qn = queue_pop(window);
-        struct rdWindowEntry *e = queue_entry(qn, struct rdWindowEntry, n);
-        free(e);
-    }
+    free(rstate->missingPackets);
+    free(rstate->RD);
 }
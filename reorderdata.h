@@ -27,10 +27,6 @@
 #define _PD3_ESTIMATOR_REORDERDATA_H_
 
 #include "datatypes.h"
-#include "rbtree.h"
-#include "queue.h"
-
-#define REORDER_MAX_HISTORY (REORDER_MAX_EXTENT * 2)
 
 typedef int ReorderDistance;
 
@@ -38,54 +34,51 @@ struct reorderDataA {
     struct seqnoRangeList ranges;  /* linked with next pointer */
 };
 
+/* Allocated with room for the histograms sized by reorderdata_init(),
+ * see reorderdata_size(). Must be the last member of any enclosing
+ * structure. */
 struct reorderDataR {
-    /* Extents learned by processing the packets in this stream
-     * record. In-order packets have extent 0. Reordered packets have
-     * extent computed based on missed packet information. */
-    PACKETCOUNT extentToCount[REORDER_MAX_EXTENT + 1];
-
-    /* Reorder Distance metric */
-    PACKETCOUNT FD[REORDER_WINDOW_SIZE]; /* Frequency of lateness and earliness */
-
     /* Packets that we assume to be dropped because they were recorded
      * as missing but never observed */
     PACKETCOUNT extent_assumed_drops;
     PACKETCOUNT rd_assumed_drops;
-};
 
-/* Keyed by SEQNO */
-struct reorderMissingPacket {
-    /* Key */
-    SEQNO seq;
-
-    /* Has this packet been observed? */
-    uint8_t observed;
-
-    /* Reference index for this missing packet */
-    PACKETCOUNT refIndex;
-
-    /* Computed extent, initialized to -1 */
-    int extent;
-
-    /* To allow insertion in rbtree */
-    RBTreeNode n;
+    /* Extents learned by processing the packets in this stream
+     * record, binned by reorderdata_extent_bin(), plus a bin for
+     * extents capped at the maximum extent, followed by the Reorder
+     * Distance metric's frequency of lateness and earliness, from -DT
+     * to DT. In-order packets have extent 0. Reordered packets have
+     * extent computed based on missed packet information. See
+     * reorderdata_extents() and reorderdata_fd(). */
+    PACKETCOUNT bins[];
 };
 
-struct rdWindowEntry {
-    /* The key */
-    SEQNO seq;
-
-    QueueNode n;
+/* States of a reorder history slot */
+#define REORDER_SLOT_NONE     0  /* not missing, or no longer tracked */
+#define REORDER_SLOT_MISSING  1  /* missing, not yet observed */
+#define REORDER_SLOT_OBSERVED 2  /* missing, since observed */
+
+/* Missing packet records of a stream, held in a circular array
+ * covering twice the maximum extent plus one sequence numbers from
+ * `base`. The slot of sequence number `seq` is (head + seq - base)
+ * modulo the size. */
+struct reorderHistory {
+    /* Oldest sequence number covered, and its slot */
+    SEQNO base;
+    unsigned int head;
+
+    /* Number of slots not in state REORDER_SLOT_NONE */
+    unsigned int count;
+
+    /* Reference index of each missing packet, and slot states,
+     * allocated along with the structure */
+    PACKETCOUNT *refIndex;
+    uint8_t *state;
 };
 
-struct rdBufferEntry {
-    /* The key */
-    SEQNO seq;
-
-    /* To allow insertion into rbtree */
-    RBTreeNode n;
-};
+#define RD_BITSET_WORDS(bits) (((bits) + 63) / 64)
 
+/* Arrays are allocated along with the structure and sized by DT */
 struct rdState {
     /* 0 means processing window items, 1 means looking for next
      * arrival */
@@ -98,8 +91,26 @@ struct rdState {
      * numbers? */
     uint8_t window_initialized;
 
-    Queue window;
-    RBTree buffer;
+    /* The window, in arrival order, as a ring of DT + 1 sequence
+     * numbers */
+    SEQNO *window;
+    unsigned int window_head;
+    unsigned int window_size;
+
+    /* Ascending run of window sequence numbers, each smaller than
+     * every later arrival. Its head is the window minimum. */
+    SEQNO *window_min;
+    unsigned int window_min_head;
+    unsigned int window_min_size;
+
+    /* Window membership: open addressing on the sequence number, with
+     * a bitset of occupied slots, kept at most half full */
+    SEQNO *window_set;
+    uint64_t *window_set_used;
+
+    /* Buffered sequence numbers, which always fall within DT of RI.
+     * Bit i is set when RI + i is buffered. */
+    uint64_t *buffer;
 };
 
 struct reorderState {
@@ -114,15 +125,42 @@ struct reorderState {
     /* Next expected sequence number */
     SEQNO nextExp;
 
-    /* Stores missing packet records */
-    RBTree missingPackets;
+    /* Stores missing packet records, allocated upon the first
+     * sequence discontinuity */
+    struct reorderHistory *missingPackets;
 
     /*------Reorder-Distance data structures-----*/
-    struct rdState RD;
+    struct rdState *RD;
 };
 
+/* Largest supported extent precision */
+#define REORDER_MAX_EXTENT_PRECISION 16
+
 /* Returns 0 on success, -1 on error */
-int reorderdata_init(bool measure_reorder_extent, bool measure_reorder_density);
+int reorderdata_init(bool measure_reorder_extent, bool measure_reorder_density,
+                     unsigned int max_extent, unsigned int dt,
+                     unsigned int extent_precision);
+
+/* Configured maximum extent and displacement threshold */
+unsigned int reorderdata_max_extent(void);
+unsigned int reorderdata_dt(void);
+
+/* Extent bin counting extents below the maximum extent, and the
+ * range of extents counted in a bin. Each extent has its own bin when
+ * the extent precision is 0. */
+unsigned int reorderdata_extent_bin(unsigned int extent);
+void reorderdata_extent_bin_bounds(unsigned int bin, uint32_t *low, uint32_t *high);
+
+/* Number of extent bins covering extents below the maximum extent */
+unsigned int reorderdata_num_extent_bins(void);
+
+/* Size of a struct reorderDataR, including its histograms */
+size_t reorderdata_size(void);
+
+/* Histograms of a reporter record: reorderdata_num_extent_bins() + 1
+ * extent bins, and 2 * DT + 1 frequencies indexed by distance + DT */
+PACKETCOUNT *reorderdata_extents(struct reorderDataR *dr);
+PACKETCOUNT *reorderdata_fd(struct reorderDataR *dr);
 
 /* Invoked by aggregator. Returns 0 on success, -1 on error */
 int reorderdata_arrival(struct reorderDataA *rd, SEQNO seqno, struct seqnoRangeList *free_ranges);
@@ -139,8 +177,6 @@ void reorderdata_accumulate_time(struct reorderDataR *accum,
 void reorderdata_accumulate_flows(struct reorderDataR *accum,
                                   struct reorderDataR *unit);
 
-void reorderdata_destroy_missing_packets(RBTree *missingPackets);
-void reorderdata_destroy_rd_buffer(RBTree *buffer);
-void reorderdata_destroy_rd_window(Queue *window);
+void reorderdata_destroy_state(struct reorderState *rstate);
 
 #endif /* _PD3_ESTIMATOR_REORDERDATA_H */
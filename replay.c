@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2022-2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+/* Replays a capture file, written with the capture_path option,
+ * through the estimator as fast as it will take the packet infos, and
+ * reports the push throughput along with the estimator's results. */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pd3_estimator.h"
+
+static int quiet = 0;
+static unsigned long reported_flows = 0;
+
+/* Dumps one line per flow */
+static void replay_callback(void *context, pd3_estimator_results *results)
+{
+    (void) context;
+
+    reported_flows++;
+    if (quiet) {
+        return;
+    }
+    fprintf(stdout, "flow_key = (");
+    for (int i = 0; i < PD3_ESTIMATOR_KEY_SIZE; i++) {
+        fprintf(stdout, "%s%u", i ? ", " : "", results->flow_key[i]);
+    }
+    fprintf(stdout, ") duration = %lu packets = %u", results->duration, results->packet_count);
+    if (results->loss) {
+        fprintf(stdout, " received = %.0f dropped = %.0f loss = %f",
+                results->loss_results.packets_received,
+                results->loss_results.packets_dropped,
+                results->loss_results.value);
+    }
+    if (results->reorder_extent) {
+        fprintf(stdout, " assumed_drops = %u", results->reorder_extent_results.assumed_drops);
+    }
+    fprintf(stdout, "\n");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] capture-file\n"
+            "  -s schedule     reporter schedule (default c,1,0)\n"
+            "  -i interval     aggregation interval in seconds (default 0.1)\n"
+            "  -a aggregators  number of aggregator threads (default 1)\n"
+            "  -r ring-size    per-handle ring capacity, 0 for the shared queue (default 0)\n"
+            "  -w workers      number of reporter workers (default 1)\n"
+            "  -t seconds      time to wait for the last reports (default 2)\n"
+            "  -v              run on a virtual clock driven by the capture's timestamps\n"
+            "  -q              do not print per-flow results\n",
+            prog);
+}
+
+static double elapsed(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const pd3_estimator_capture_header *header;
+    const pd3_estimator_capture_record *records;
+    pd3_estimator_packet_info pinfos[PD3_ESTIMATOR_BATCH_SIZE];
+    pd3_estimator_options options;
+    pd3_estimator_callbacks callbacks;
+    pd3_estimator_handle *handle;
+    struct timespec start, end;
+    struct stat st;
+    size_t count, n, accepted;
+    unsigned int wait = 2;
+    void *map;
+    int fd, opt;
+
+    memset(&options, 0, sizeof(options));
+    options.aggregation_interval = 0.1;
+    options.reporter_schedule = "c,1,0";
+    options.reporter_min_batches = 1;
+    options.measure_loss = true;
+    options.measure_reorder_extent = true;
+    options.measure_reorder_density = true;
+
+    while ((opt = getopt(argc, argv, "s:i:a:r:w:t:qv")) != -1) {
+        switch (opt) {
+        case 's': options.reporter_schedule = optarg; break;
+        case 'i': options.aggregation_interval = atof(optarg); break;
+        case 'a': options.num_aggregators = atoi(optarg); break;
+        case 'r': options.ring_size = atoi(optarg); break;
+        case 'w': options.num_reporter_workers = atoi(optarg); break;
+        case 't': wait = atoi(optarg); break;
+        case 'q': quiet = 1; break;
+        case 'v': options.virtual_clock = true; break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* Map the capture file */
+    fd = open(argv[optind], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(argv[optind]);
+        return -1;
+    }
+    if ((size_t) st.st_size < sizeof(*header)) {
+        fprintf(stderr, "%s: not a capture file\n", argv[optind]);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    header = map;
+    if (header->magic != PD3_ESTIMATOR_CAPTURE_MAGIC ||
+        header->version != PD3_ESTIMATOR_CAPTURE_VERSION ||
+        header->key_size != PD3_ESTIMATOR_KEY_SIZE ||
+        header->record_size != sizeof(*records)) {
+        fprintf(stderr, "%s: unsupported capture file\n", argv[optind]);
+        return -1;
+    }
+    records = (const pd3_estimator_capture_record *) (header + 1);
+    count = (st.st_size - sizeof(*header)) / sizeof(*records);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* Periods start with the first packet of the capture */
+    if (options.virtual_clock && count > 0) {
+        options.virtual_clock_start = records[0].timestamp;
+    }
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.cb = replay_callback;
+    if (pd3_estimator_init(&options, &callbacks) != 0) {
+        fprintf(stderr, "Could not initialize pd3 estimator library\n");
+        return -1;
+    }
+    handle = pd3_estimator_create_handle();
+    if (!handle) {
+        fprintf(stderr, "Could not create handle to estimation service\n");
+        return -1;
+    }
+
+    /* Push the records in blocks, as fast as the service takes them */
+    memset(pinfos, 0, sizeof(pinfos));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < count; i += n) {
+        n = (count - i < PD3_ESTIMATOR_BATCH_SIZE) ? count - i : PD3_ESTIMATOR_BATCH_SIZE;
+        for (size_t j = 0; j < n; j++) {
+            pinfos[j].stream = records[i + j].stream;
+            pinfos[j].seq = records[i + j].seq;
+            pinfos[j].timestamp = records[i + j].timestamp;
+        }
+        for (size_t j = 0; j < n; j += accepted) {
+            if (pd3_estimator_push_packet_infos(handle, pinfos + j, n - j, &accepted) == 0) {
+                break;
+            }
+            if (!options.ring_size) {
+                fprintf(stderr, "push failed\n");
+                break;
+            }
+            /* A full ring stops the push part way: let the aggregators
+             * catch up, then push the rest */
+            pd3_estimator_flush(handle);
+            sched_yield();
+        }
+        pd3_estimator_flush(handle);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* Give the reporter time to report the tail of the capture */
+    if (options.virtual_clock && count > 0) {
+        pd3_estimator_advance_clock(records[count - 1].timestamp + wait * 1000000ull);
+    }
+    sleep(wait);
+    pd3_estimator_destroy_handle(handle);
+    pd3_estimator_destroy();
+
+    fprintf(stdout, "replayed %zu packets in %.3f s: %.3f Mpps, %lu flow reports\n",
+            count, elapsed(&start, &end), count / elapsed(&start, &end) / 1e6,
+            reported_flows);
+    munmap(map, st.st_size);
+
+    return 0;
+}
@@ -33,11 +33,13 @@
 struct reporterData {    /* transient */
     struct packetData received;
     struct lossDataR loss;
-    struct reorderDataR reorder;
     union {
         unsigned int *flow;    /* key = flow, point to corresponding group */
         unsigned int group;    /* key = group, count flows */
     } flow_count;
+
+    /* Must be last: sized at run time, see reorderdata_size() */
+    struct reorderDataR reorder;
 };
 
 struct stateData {    /* semi-permanent */
@@ -28,7 +28,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
 #include "datatypes.h"
 #include "reportschedule.h"
 
@@ -56,14 +55,7 @@ static struct repeating_item *schedule;
 
 static char *tokenize(char *s, char sep);
 
-static TIMESTAMP now() {
-  struct timeval tv;
-
-  (void) gettimeofday(&tv, NULL);
-  return (TIMESTAMP) tv.tv_sec * 1e6 + (TIMESTAMP) tv.tv_usec;
-}
-
-int set_schedule(char *sch)
+int set_schedule(char *sch, TIMESTAMP now)
 {
     unsigned int n;
     char *t;
@@ -78,7 +70,7 @@ int set_schedule(char *sch)
         fprintf(stderr, "calloc failed\n");
         return -1;
     }
-    timezero = now();
+    timezero = now;
     while (sch) {
         t = tokenize(sch, ';');
         schedule[nitems].outlets = sch;
@@ -131,16 +123,26 @@ unsigned int schedule_parallelism(void) {
   return (nitems);
 }
 
-char *schedule_outlets(unsigned int x) {
-  return (now() < schedule[x].next_run ? NULL : schedule[x].outlets);
+char *schedule_outlets(unsigned int x, TIMESTAMP now) {
+  return (now < schedule[x].next_run ? NULL : schedule[x].outlets);
+}
+
+bool schedule_has_outlet(char outlet) {
+  for (unsigned int x = 0; x < nitems; x++) {
+    if (strchr(schedule[x].outlets, outlet)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void schedule_reset(unsigned int x) {
+/* Moves the next run past `now`, skipping the runs that were missed */
+void schedule_reset(unsigned int x, TIMESTAMP now) {
   struct repeating_item *ri;
 
   ri = schedule + x;
   ri->next_run += (TIMEINTERVAL) (ri->interval *
-          ceil((double) (now() - ri->next_run) / (double) ri->interval));
+          (floor((double) (now - ri->next_run) / (double) ri->interval) + 1));
 }
 
 TIMEINTERVAL get_duration(unsigned int x) {
@@ -28,11 +28,16 @@
 
 #include "pd3_estimator.h"
 
-int set_schedule(char *sch);
+/* Times are in microseconds since the epoch; the schedule starts at
+ * `now` */
+int set_schedule(char *sch, TIMESTAMP now);
 void destroy_schedule(void);
 unsigned int schedule_parallelism(void);
-char *schedule_outlets(unsigned int x);
-void schedule_reset(unsigned int x);
+char *schedule_outlets(unsigned int x, TIMESTAMP now);
+
+/* Does any report of the schedule go to `outlet`? */
+bool schedule_has_outlet(char outlet);
+void schedule_reset(unsigned int x, TIMESTAMP now);
 TIMEINTERVAL get_duration(unsigned int x);
 
 #endif /* _PD3_ESTIMATOR_REPORT_SCHEDULE_ */
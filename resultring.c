@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "resultring.h"
+
+/* Records start on a page of their own */
+#define RESULTRING_DATA_OFFSET 4096
+#define RESULTRING_ALIGN(x) (((x) + 7) & ~(size_t) 7)
+
+struct resultRing {
+    pd3_estimator_ring_header *header;
+    uint8_t *data;
+    size_t map_size;
+    uint64_t mask;
+    uint64_t pos;        /* where the next record goes */
+    uint64_t report;     /* number of the current report */
+    uint64_t flows;      /* flow records in the current report */
+    unsigned int skipped; /* flows too large for the ring */
+};
+
+struct resultRing *resultring_create(const char *path, unsigned int size)
+{
+    struct resultRing *r;
+    uint64_t capacity;
+    int fd;
+
+    for (capacity = 4096; capacity < size; capacity <<= 1)
+        ;
+
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+    r->map_size = RESULTRING_DATA_OFFSET + capacity;
+    r->mask = capacity - 1;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("open");
+        free(r);
+        return NULL;
+    }
+    if (ftruncate(fd, r->map_size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        unlink(path);
+        free(r);
+        return NULL;
+    }
+    r->header = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->header == MAP_FAILED) {
+        perror("mmap");
+        unlink(path);
+        free(r);
+        return NULL;
+    }
+    r->data = (uint8_t *) r->header + RESULTRING_DATA_OFFSET;
+
+    /* The file is zero-filled; announce it last */
+    r->header->version = PD3_ESTIMATOR_RING_VERSION;
+    r->header->key_size = PD3_ESTIMATOR_KEY_SIZE;
+    r->header->data_offset = RESULTRING_DATA_OFFSET;
+    r->header->capacity = capacity;
+    __atomic_store_n(&r->header->magic, PD3_ESTIMATOR_RING_MAGIC, __ATOMIC_RELEASE);
+    return r;
+}
+
+void resultring_destroy(struct resultRing *r)
+{
+    if (!r) {
+        return;
+    }
+    if (r->skipped > 0) {
+        fprintf(stderr, "results ring: %u flow(s) too large to write\n", r->skipped);
+    }
+    munmap(r->header, r->map_size);
+    free(r);
+}
+
+/* Returns room for a record of `size` bytes, claimed from readers, or
+ * NULL if the ring is too small. Pads to the end of the data first if
+ * the record would not fit there. */
+static void *ring_reserve(struct resultRing *r, size_t size)
+{
+    uint64_t capacity = r->mask + 1;
+    uint64_t offset = r->pos & r->mask;
+    uint64_t pad = 0;
+
+    if (size > capacity) {
+        return NULL;
+    }
+    if (capacity - offset < size) {
+        pad = capacity - offset;
+    }
+
+    /* Readers check `reserved` after reading, so it must move before
+     * the bytes it covers are overwritten */
+    __atomic_store_n(&r->header->reserved, r->pos + pad + size, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (pad > 0) {
+        pd3_estimator_ring_record *rec = (pd3_estimator_ring_record *) (r->data + offset);
+        rec->size = pad;
+        rec->type = PD3_ESTIMATOR_RING_PAD;
+        rec->flags = 0;
+        r->pos += pad;
+    }
+    offset = r->pos & r->mask;
+    r->pos += size;
+    return r->data + offset;
+}
+
+static inline void ring_commit(struct resultRing *r)
+{
+    __atomic_store_n(&r->header->committed, r->pos, __ATOMIC_RELEASE);
+}
+
+void resultring_add(struct resultRing *r, const pd3_estimator_results *results)
+{
+    const pd3_estimator_reorder_extent_results *ext = &results->reorder_extent_results;
+    const pd3_estimator_reorder_density_results *den = &results->reorder_density_results;
+    pd3_estimator_ring_flow *rec;
+    pd3_estimator_reorder_extent_bin *extent_bins;
+    pd3_estimator_reorder_density_bin *density_bins;
+    uint32_t num_extent = 0, num_density = 0;
+    size_t size;
+
+    /* Size the record by its non-zero bins */
+    if (results->reorder_extent) {
+        if (ext->sparse_bins) {
+            num_extent = ext->num_bins;
+        }
+        else {
+            for (uint32_t i = 0; i < ext->num_bins; i++) {
+                num_extent += (ext->bins[i] > 0);
+            }
+        }
+    }
+    if (results->reorder_density) {
+        for (uint32_t i = 0; i < den->num_bins; i++) {
+            num_density += (den->bins[i].frequency > 0);
+        }
+    }
+    size = RESULTRING_ALIGN(sizeof(*rec) + num_extent * sizeof(*extent_bins)
+                            + num_density * sizeof(*density_bins));
+
+    rec = ring_reserve(r, size);
+    if (!rec) {
+        r->skipped++;
+        return;
+    }
+    rec->record.size = size;
+    rec->record.type = PD3_ESTIMATOR_RING_FLOW;
+    rec->record.flags = (results->loss ? PD3_ESTIMATOR_RING_LOSS : 0)
+        | (results->reorder_extent ? PD3_ESTIMATOR_RING_REORDER_EXTENT : 0)
+        | (results->reorder_density ? PD3_ESTIMATOR_RING_REORDER_DENSITY : 0);
+    rec->report = r->report;
+    rec->earliest = results->earliest;
+    rec->latest = results->latest;
+    rec->duration = results->duration;
+    rec->min_seq = results->min_seq;
+    rec->max_seq = results->max_seq;
+    rec->packet_count = results->packet_count;
+    rec->assumed_drops = ext->assumed_drops;
+    rec->loss_results = results->loss_results;
+    rec->num_extent_bins = num_extent;
+    rec->num_density_bins = num_density;
+    memcpy(rec->flow_key, results->flow_key, sizeof(rec->flow_key));
+
+    extent_bins = (pd3_estimator_reorder_extent_bin *) (rec + 1);
+    if (num_extent > 0 && ext->sparse_bins) {
+        memcpy(extent_bins, ext->sparse_bins, num_extent * sizeof(*extent_bins));
+    }
+    else if (num_extent > 0) {
+        for (uint32_t i = 0, n = 0; i < ext->num_bins; i++) {
+            if (ext->bins[i] > 0) {
+                extent_bins[n].min_extent = ext->bin_min_extent[i];
+                extent_bins[n].max_extent = ext->bin_max_extent[i];
+                extent_bins[n].count = ext->bins[i];
+                n++;
+            }
+        }
+    }
+    density_bins = (pd3_estimator_reorder_density_bin *) (extent_bins + num_extent);
+    for (uint32_t i = 0, n = 0; n < num_density; i++) {
+        if (den->bins[i].frequency > 0) {
+            density_bins[n++] = den->bins[i];
+        }
+    }
+
+    ring_commit(r);
+    r->flows++;
+}
+
+void resultring_end_report(struct resultRing *r, TIMEINTERVAL duration)
+{
+    pd3_estimator_ring_report *rec = ring_reserve(r, RESULTRING_ALIGN(sizeof(*rec)));
+
+    /* The ring always has room for this one */
+    rec->record.size = RESULTRING_ALIGN(sizeof(*rec));
+    rec->record.type = PD3_ESTIMATOR_RING_REPORT;
+    rec->record.flags = 0;
+    rec->report = r->report;
+    rec->duration = duration;
+    rec->flows = r->flows;
+    ring_commit(r);
+
+    r->report++;
+    r->flows = 0;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_RESULTRING_H_
+#define _PD3_ESTIMATOR_RESULTRING_H_
+
+#include "pd3_estimator.h"
+
+/* Data size of a results ring when none is given */
+#define RESULTRING_DEFAULT_SIZE (1 << 20)
+
+/* Writer of the results ring file described along with
+ * pd3_estimator_ring_header. Records are built in place in the
+ * shared mapping. */
+struct resultRing;
+
+/* Creates the file at `path` and maps a ring of `size` bytes of
+ * records, rounded up to a power of two. Returns NULL on error. */
+struct resultRing *resultring_create(const char *path, unsigned int size);
+
+/* Unmaps the ring. The file remains for readers. */
+void resultring_destroy(struct resultRing *r);
+
+/* Writes a flow record of the current report, keeping the non-zero
+ * histogram bins only */
+void resultring_add(struct resultRing *r, const pd3_estimator_results *results);
+
+/* Writes the report record closing the current report */
+void resultring_end_report(struct resultRing *r, TIMEINTERVAL duration);
+
+#endif /* _PD3_ESTIMATOR_RESULTRING_H_ */
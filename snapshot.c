@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+#include "snapshot.h"
+
+/* A slot holds a flow if its generation is the table's */
+struct snapshotSlot {
+    unsigned int generation;
+    pd3_estimator_results results;
+};
+
+struct snapshotTable {
+    _Atomic unsigned int seq;      /* odd while being written */
+    unsigned int generation;
+    unsigned int count;
+    struct snapshotSlot *slots;
+};
+
+struct snapshotStore {
+    struct snapshotTable tables[2];
+    struct snapshotTable *_Atomic published;
+    struct snapshotTable *writing;
+    unsigned int capacity;
+    unsigned int mask;             /* slots - 1, kept at most half full */
+};
+
+struct snapshotStore *snapshot_create(unsigned int capacity)
+{
+    struct snapshotStore *store;
+    unsigned int size;
+
+    for (size = 2; size < 2 * capacity; size <<= 1) {
+        if (size == (1u << 31)) {
+            fprintf(stderr, "snapshot capacity too large\n");
+            return NULL;
+        }
+    }
+
+    store = calloc(1, sizeof(*store));
+    if (!store) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+    store->capacity = capacity;
+    store->mask = size - 1;
+    for (int i = 0; i < 2; i++) {
+        /* Generation 0 marks empty slots */
+        store->tables[i].generation = 1;
+        store->tables[i].slots = calloc(size, sizeof(struct snapshotSlot));
+        if (!store->tables[i].slots) {
+            fprintf(stderr, "calloc failed\n");
+            snapshot_destroy(store);
+            return NULL;
+        }
+    }
+    atomic_init(&store->published, &store->tables[0]);
+    store->writing = &store->tables[1];
+    return store;
+}
+
+void snapshot_destroy(struct snapshotStore *store)
+{
+    if (!store) {
+        return;
+    }
+    free(store->tables[0].slots);
+    free(store->tables[1].slots);
+    free(store);
+}
+
+static inline unsigned int snapshot_hash(const uint8_t *flow_key)
+{
+    return (unsigned int) crc_generate((unsigned char *) flow_key, PD3_ESTIMATOR_KEY_SIZE);
+}
+
+void snapshot_begin(struct snapshotStore *store)
+{
+    struct snapshotTable *t = store->writing;
+
+    atomic_store_explicit(&t->seq, atomic_load_explicit(&t->seq, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    /* Empty the table by moving to the next generation, clearing
+     * every slot only when the generation wraps */
+    if (++t->generation == 0) {
+        memset(t->slots, 0, (store->mask + 1) * sizeof(*t->slots));
+        t->generation = 1;
+    }
+    t->count = 0;
+}
+
+void snapshot_add(struct snapshotStore *store, const pd3_estimator_results *results)
+{
+    struct snapshotTable *t = store->writing;
+    struct snapshotSlot *slot;
+    unsigned int i;
+
+    if (t->count == store->capacity) {
+        return;
+    }
+    for (i = snapshot_hash(results->flow_key) & store->mask; ; i = (i + 1) & store->mask) {
+        slot = &t->slots[i];
+        if (slot->generation != t->generation) {
+            break;
+        }
+        if (memcmp(slot->results.flow_key, results->flow_key, sizeof(results->flow_key)) == 0) {
+            /* Same flow reported twice: keep the latest */
+            t->count--;
+            break;
+        }
+    }
+    slot->results = *results;
+    slot->results.reorder_extent_results.num_bins = 0;
+    slot->results.reorder_extent_results.bins = NULL;
+    slot->results.reorder_extent_results.bin_min_extent = NULL;
+    slot->results.reorder_extent_results.bin_max_extent = NULL;
+    slot->results.reorder_extent_results.sparse_bins = NULL;
+    slot->results.reorder_density_results.num_bins = 0;
+    slot->results.reorder_density_results.bins = NULL;
+    slot->generation = t->generation;
+    t->count++;
+}
+
+void snapshot_publish(struct snapshotStore *store)
+{
+    struct snapshotTable *t = store->writing;
+
+    atomic_store_explicit(&t->seq, atomic_load_explicit(&t->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+    store->writing = atomic_exchange_explicit(&store->published, t, memory_order_acq_rel);
+}
+
+int snapshot_query(struct snapshotStore *store, const uint8_t *flow_key,
+                   pd3_estimator_results *results)
+{
+    struct snapshotTable *t;
+    struct snapshotSlot *slot;
+    unsigned int seq, generation, i, probes;
+    int found;
+
+    for (;;) {
+        t = atomic_load_explicit(&store->published, memory_order_acquire);
+        seq = atomic_load_explicit(&t->seq, memory_order_acquire);
+        if (seq & 1) {
+            /* The reporter went around twice since we looked */
+            continue;
+        }
+        generation = t->generation;
+        found = 0;
+        i = snapshot_hash(flow_key) & store->mask;
+        for (probes = 0; probes <= store->mask; probes++, i = (i + 1) & store->mask) {
+            slot = &t->slots[i];
+            if (slot->generation != generation) {
+                break;
+            }
+            if (memcmp(slot->results.flow_key, flow_key, sizeof(slot->results.flow_key)) == 0) {
+                *results = slot->results;
+                found = 1;
+                break;
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&t->seq, memory_order_relaxed) == seq) {
+            return found ? 0 : -1;
+        }
+    }
+}
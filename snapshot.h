@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_SNAPSHOT_H_
+#define _PD3_ESTIMATOR_SNAPSHOT_H_
+
+#include "pd3_estimator.h"
+
+/* Per-flow results of the most recent report, published by the
+ * reporter and read from any thread. The store holds two tables: the
+ * reporter fills one while readers use the other, then publishes it.
+ * Each table has a sequence number, odd while it is written, so that
+ * a reader that raced with a rewrite notices and retries; readers
+ * never block the reporter. Tables never move or grow. */
+struct snapshotStore;
+
+/* Returns a store holding up to `capacity` flows, or NULL on error */
+struct snapshotStore *snapshot_create(unsigned int capacity);
+void snapshot_destroy(struct snapshotStore *store);
+
+/* Reporter side: start filling the table readers are not using, add
+ * each flow's results, then make the table visible. Histogram bins
+ * are not kept. Flows beyond the capacity are dropped. */
+void snapshot_begin(struct snapshotStore *store);
+void snapshot_add(struct snapshotStore *store, const pd3_estimator_results *results);
+void snapshot_publish(struct snapshotStore *store);
+
+/* Reader side: copy the published results of the flow `flow_key`,
+ * without histogram bins. Returns 0 on success, -1 if the flow is
+ * not in the published table. */
+int snapshot_query(struct snapshotStore *store, const uint8_t *flow_key,
+                   pd3_estimator_results *results);
+
+#endif /* _PD3_ESTIMATOR_SNAPSHOT_H_ */
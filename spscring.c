@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spscring.h"
+
+struct spscRing *spscring_create(unsigned int capacity)
+{
+    struct spscRing *r;
+    unsigned int size;
+
+    for (size = 1; size < capacity; size <<= 1) {
+        if (size == (1u << 31)) {
+            fprintf(stderr, "ring capacity too large\n");
+            return NULL;
+        }
+    }
+
+    if (posix_memalign((void **) &r, SPSCRING_CACHELINE, sizeof(*r)) != 0) {
+        fprintf(stderr, "posix_memalign failed\n");
+        return NULL;
+    }
+    memset(r, 0, sizeof(*r));
+
+    r->slots = calloc(size, sizeof(*r->slots));
+    if (!r->slots) {
+        fprintf(stderr, "calloc failed\n");
+        free(r);
+        return NULL;
+    }
+    r->mask = size - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->closed, 0);
+
+    return r;
+}
+
+void spscring_destroy(struct spscRing *r)
+{
+    if (!r) {
+        return;
+    }
+    free(r->slots);
+    free(r);
+}
+
+int spscring_push(struct spscRing *r, const pd3_estimator_packet_info *p)
+{
+    if (r->pending - r->cached_head > r->mask) {
+        r->cached_head = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (r->pending - r->cached_head > r->mask) {
+            spscring_publish(r);
+            return -1;
+        }
+    }
+    r->slots[r->pending & r->mask] = *p;
+    r->pending++;
+
+    return 0;
+}
+
+void spscring_publish(struct spscRing *r)
+{
+    atomic_store_explicit(&r->tail, r->pending, memory_order_release);
+}
+
+unsigned int spscring_drain(struct spscRing *r,
+                            void (*fn)(void *, pd3_estimator_packet_info *),
+                            void *ctx)
+{
+    unsigned int head, tail;
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    for (unsigned int i = head; i != tail; i++) {
+        fn(ctx, &r->slots[i & r->mask]);
+    }
+    atomic_store_explicit(&r->head, tail, memory_order_release);
+
+    return tail - head;
+}
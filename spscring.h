@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_SPSCRING_H_
+#define _PD3_ESTIMATOR_SPSCRING_H_
+
+#include <stdatomic.h>
+#include "pd3_estimator.h"
+
+#define SPSCRING_CACHELINE 64
+
+/* Bounded single-producer/single-consumer ring of packet infos. The
+ * producer writes slots without synchronization and makes them
+ * visible to the consumer in bulk by publishing its tail; the
+ * consumer releases slots in bulk by advancing its head. Counters run
+ * freely and are masked on access, so the capacity is a power of
+ * two. Producer and consumer fields live on separate cache lines. */
+struct spscRing {
+    /* Consumer-owned */
+    _Atomic unsigned int head __attribute__((aligned(SPSCRING_CACHELINE)));
+
+    /* Producer-owned */
+    _Atomic unsigned int tail __attribute__((aligned(SPSCRING_CACHELINE)));
+    unsigned int pending;        /* next slot to write, not yet published */
+    unsigned int cached_head;
+
+    /* Fixed at creation, except for the registry linkage, which is
+     * owned by whoever keeps the list of rings */
+    unsigned int mask __attribute__((aligned(SPSCRING_CACHELINE)));
+    pd3_estimator_packet_info *slots;
+    _Atomic int closed;          /* producer is gone; drain and destroy */
+    struct spscRing *next;
+};
+
+/* Returns a ring holding at least `capacity` packet infos, or NULL on
+ * error */
+struct spscRing *spscring_create(unsigned int capacity);
+void spscring_destroy(struct spscRing *r);
+
+/* Producer side. spscring_push() returns 0 on success and -1 if the
+ * ring is full, in which case everything pending is published so that
+ * the consumer can make room. */
+int spscring_push(struct spscRing *r, const pd3_estimator_packet_info *p);
+void spscring_publish(struct spscRing *r);
+
+/* Consumer side. Invokes `fn` on every published packet info, in
+ * order, passing `ctx` along, then releases their slots. Returns the
+ * number consumed. */
+unsigned int spscring_drain(struct spscRing *r,
+                            void (*fn)(void *, pd3_estimator_packet_info *),
+                            void *ctx);
+
+#endif /* _PD3_ESTIMATOR_SPSCRING_H_ */
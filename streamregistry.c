@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "streamregistry.h"
+
+/* Slots live in fixed-size chunks that are allocated on demand and
+ * never moved, so a slot index maps to its storage in two array
+ * lookups and readers never see a reallocation. */
+#define STREAMREGISTRY_CHUNK 1024
+#define STREAMREGISTRY_NCHUNKS \
+    ((PD3_ESTIMATOR_MAX_STREAMS + STREAMREGISTRY_CHUNK - 1) / STREAMREGISTRY_CHUNK)
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct streamSlot *chunks[STREAMREGISTRY_NCHUNKS];
+static _Atomic uint32_t nslots;    /* slot 0 is never handed out */
+
+int streamregistry_add(const stream_tuple *stream, unsigned int shard)
+{
+    struct streamSlot *chunk;
+    uint32_t slot;
+
+    pthread_mutex_lock(&registry_mutex);
+    slot = atomic_load_explicit(&nslots, memory_order_relaxed) + 1;
+    if (slot > PD3_ESTIMATOR_MAX_STREAMS) {
+        pthread_mutex_unlock(&registry_mutex);
+        fprintf(stderr, "too many registered streams\n");
+        return -1;
+    }
+
+    chunk = chunks[(slot - 1) / STREAMREGISTRY_CHUNK];
+    if (!chunk) {
+        chunk = calloc(STREAMREGISTRY_CHUNK, sizeof(*chunk));
+        if (!chunk) {
+            pthread_mutex_unlock(&registry_mutex);
+            fprintf(stderr, "calloc failed\n");
+            return -1;
+        }
+        chunks[(slot - 1) / STREAMREGISTRY_CHUNK] = chunk;
+    }
+    chunk[(slot - 1) % STREAMREGISTRY_CHUNK].stream = *stream;
+    chunk[(slot - 1) % STREAMREGISTRY_CHUNK].shard = shard;
+
+    /* Publish the slot only once its contents are in place */
+    atomic_store_explicit(&nslots, slot, memory_order_release);
+    pthread_mutex_unlock(&registry_mutex);
+
+    return (int) slot;
+}
+
+const struct streamSlot *streamregistry_get(uint32_t slot)
+{
+    if (slot == 0 || slot > atomic_load_explicit(&nslots, memory_order_acquire)) {
+        return NULL;
+    }
+
+    return &chunks[(slot - 1) / STREAMREGISTRY_CHUNK][(slot - 1) % STREAMREGISTRY_CHUNK];
+}
+
+void streamregistry_destroy()
+{
+    pthread_mutex_lock(&registry_mutex);
+    for (unsigned int i = 0; i < STREAMREGISTRY_NCHUNKS; i++) {
+        free(chunks[i]);
+        chunks[i] = NULL;
+    }
+    atomic_store_explicit(&nslots, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&registry_mutex);
+}
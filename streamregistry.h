@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_STREAMREGISTRY_H_
+#define _PD3_ESTIMATOR_STREAMREGISTRY_H_
+
+#include "pd3_estimator.h"
+
+/* A registered stream. Slots are never reused or moved while the
+ * library is running, so readers may hold on to them without a
+ * lock. */
+struct streamSlot {
+    stream_tuple stream;
+    unsigned int shard;    /* aggregator that owns the stream */
+};
+
+/* Registers a stream owned by the given aggregator shard. Returns its
+ * slot, which is at least 1, or -1 on error. */
+int streamregistry_add(const stream_tuple *stream, unsigned int shard);
+
+/* Returns the registered stream for `slot`, or NULL if no stream was
+ * registered under it. Safe to call from any thread. */
+const struct streamSlot *streamregistry_get(uint32_t slot);
+
+void streamregistry_destroy(void);
+
+#endif /* _PD3_ESTIMATOR_STREAMREGISTRY_H_ */
@@ -37,6 +37,10 @@
  * the callback. */
 typedef struct publish_context {
     /* Add application-specific fields here */
+
+    /* Reorder density of the flows (2, 1) and (2, 2), indexed by
+     * distance + REORDER_DT and totalled over their reports */
+    PACKETCOUNT density[2][REORDER_WINDOW_SIZE];
 } publish_context;
 
 /* Sample callback function that demonstrates how to process reported
@@ -58,8 +62,13 @@ void my_callback(void *context, pd3_estimator_results *results)
     if (results->reorder_extent) {
         for (uint32_t i = 0; i < results->reorder_extent_results.num_bins; i++) {
             PACKETCOUNT frequency = results->reorder_extent_results.bins[i];
-            if (frequency > 0) {
-                fprintf(stdout, "\tExtent %u: %u\n", i, frequency);
+            uint32_t min_extent = results->reorder_extent_results.bin_min_extent[i];
+            uint32_t max_extent = results->reorder_extent_results.bin_max_extent[i];
+            if (frequency > 0 && min_extent == max_extent) {
+                fprintf(stdout, "\tExtent %u: %u\n", min_extent, frequency);
+            }
+            else if (frequency > 0) {
+                fprintf(stdout, "\tExtents %u-%u: %u\n", min_extent, max_extent, frequency);
             }
         }
         fprintf(stdout, "\tAssumed drops: %u\n",
@@ -73,6 +82,10 @@ void my_callback(void *context, pd3_estimator_results *results)
             if (frequency > 0) {
                 fprintf(stdout, "\tDistance %d: %u\n", distance, frequency);
             }
+            if (results->flow_key[0] == 2 && (results->flow_key[1] == 1 || results->flow_key[1] == 2) &&
+                distance >= -REORDER_DT && distance <= REORDER_DT) {
+                con->density[results->flow_key[1] - 1][distance + REORDER_DT] += frequency;
+            }
         }
     }
 }
@@ -166,6 +179,46 @@ int main()
         sleep(10);
     }
 
+    {
+        /* Long in-order runs take a shortcut through the window, with
+         * or without a hole left by a drop. The frequencies are those
+         * of the per-packet path: the first dt + 1 arrivals fill the
+         * window, and after the drop RI keeps skipping a hole */
+        PACKETCOUNT expected[2][REORDER_WINDOW_SIZE] = {
+            [0][REORDER_DT] = 2790,
+            [1][REORDER_DT] = 2991,
+        };
+        fprintf(stdout, "TEST flow=(2,1), stream=44: seq 1 - 3000, dropping 1000\n");
+        fprintf(stdout, "TEST flow=(2,2), stream=44: seq 1 - 3000\n");
+        memset(&ppi, 0, sizeof(ppi));
+        ppi.stream.flow_key[0] = 2;
+        ppi.stream.stream_id = 44;
+        for (SEQNO seq = 1; seq <= 3000; seq++) {
+            ppi.seq = seq;
+            ppi.stream.flow_key[1] = 1;
+            if (seq != 1000) {
+                pd3_estimator_push_packet_info(handle, &ppi);
+            }
+            ppi.stream.flow_key[1] = 2;
+            pd3_estimator_push_packet_info(handle, &ppi);
+        }
+        fprintf(stdout, "flushing...\n");
+        pd3_estimator_flush(handle);
+        sleep(10);
+        for (int f = 0; f < 2; f++) {
+            for (int d = -REORDER_DT; d <= REORDER_DT; d++) {
+                if (context.density[f][d + REORDER_DT] != expected[f][d + REORDER_DT]) {
+                    fprintf(stderr, "flow=(2,%d): distance %d: %u, expected %u\n", f + 1, d,
+                            context.density[f][d + REORDER_DT], expected[f][d + REORDER_DT]);
+                    ret = -1;
+                }
+            }
+        }
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
     /* Clean up the handle */
     fprintf(stdout, "destroying...\n");
     pd3_estimator_destroy_handle(handle);
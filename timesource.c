@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <stdatomic.h>
+#include <sys/time.h>
+#include "timesource.h"
+
+static bool virtual_time;
+static _Atomic TIMESTAMP virtual_now;
+
+void timesource_init(bool virtual_clock, TIMESTAMP start)
+{
+    virtual_time = virtual_clock;
+    atomic_store(&virtual_now, start);
+}
+
+bool timesource_virtual(void)
+{
+    return virtual_time;
+}
+
+TIMESTAMP timesource_now(void)
+{
+    struct timeval tv;
+
+    if (virtual_time) {
+        return atomic_load_explicit(&virtual_now, memory_order_acquire);
+    }
+    gettimeofday(&tv, NULL);
+    return (TIMESTAMP) tv.tv_sec * 1000000 + (TIMESTAMP) tv.tv_usec;
+}
+
+void timesource_advance(TIMESTAMP t)
+{
+    TIMESTAMP now = atomic_load_explicit(&virtual_now, memory_order_relaxed);
+
+    while (now < t &&
+           !atomic_compare_exchange_weak_explicit(&virtual_now, &now, t,
+                                                  memory_order_release,
+                                                  memory_order_relaxed))
+        ;
+}
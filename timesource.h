@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_TIMESOURCE_H_
+#define _PD3_ESTIMATOR_TIMESOURCE_H_
+
+#include "pd3_estimator.h"
+
+/* Source of the current time, in microseconds since the epoch: the
+ * wall clock, or a virtual clock that only moves when told to. The
+ * virtual clock never goes backwards. */
+void timesource_init(bool virtual_clock, TIMESTAMP start);
+bool timesource_virtual(void);
+TIMESTAMP timesource_now(void);
+
+/* Moves the virtual clock forward to `t`, if it is behind. Packets
+ * made visible to the aggregators before the call are seen by any
+ * thread that reads the new time. */
+void timesource_advance(TIMESTAMP t);
+
+#endif /* _PD3_ESTIMATOR_TIMESOURCE_H_ */
@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "workerpool.h"
+
+struct workerPool {
+    workerpool_task task;
+    void *arg;
+    unsigned int nworkers;
+    pthread_t *tids;              /* workers 1 to nworkers - 1 */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int round;           /* incremented to start a round */
+    unsigned int running;         /* threads still in the round */
+    int stop;
+};
+
+struct workerArg {
+    struct workerPool *pool;
+    unsigned int worker;
+};
+
+static void *worker_thread(void *arg)
+{
+    struct workerArg *wa = arg;
+    struct workerPool *pool = wa->pool;
+    unsigned int worker = wa->worker;
+    unsigned int round = 0;
+
+    free(wa);
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->round == round && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        round = pool->round;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->task(pool->arg, worker);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return NULL;
+}
+
+struct workerPool *workerpool_create(unsigned int nworkers, workerpool_task task, void *arg)
+{
+    struct workerPool *pool;
+    struct workerArg *wa;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        fprintf(stderr, "calloc failed\n");
+        return NULL;
+    }
+    pool->task = task;
+    pool->arg = arg;
+    pool->nworkers = (nworkers > 0) ? nworkers : 1;
+    pool->tids = calloc(pool->nworkers, sizeof(*pool->tids));
+    if (!pool->tids) {
+        fprintf(stderr, "calloc failed\n");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (unsigned int i = 1; i < pool->nworkers; i++) {
+        wa = malloc(sizeof(*wa));
+        if (!wa) {
+            fprintf(stderr, "malloc failed\n");
+        }
+        else {
+            wa->pool = pool;
+            wa->worker = i;
+            if (pthread_create(&pool->tids[i], NULL, worker_thread, wa) == 0) {
+                continue;
+            }
+            perror("pthread");
+            free(wa);
+        }
+        /* Run with the workers started so far, the caller being one */
+        fprintf(stderr, "running with %u of %u workers\n", i, pool->nworkers);
+        pool->nworkers = i;
+        break;
+    }
+    return pool;
+}
+
+void workerpool_run(struct workerPool *pool)
+{
+    if (pool->nworkers > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->running = pool->nworkers - 1;
+        pool->round++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    pool->task(pool->arg, 0);
+
+    if (pool->nworkers > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->running > 0) {
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void workerpool_destroy(struct workerPool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned int i = 1; i < pool->nworkers; i++) {
+        if (pthread_join(pool->tids[i], NULL) != 0) {
+            perror("pthread_join");
+        }
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->tids);
+    free(pool);
+}
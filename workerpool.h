@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+/* Copyright (c) 2023 Peraton Labs Inc.
+ *
+ * This software was developed in work supported by the following U.S.
+ * Government contracts:
+ *
+ * HR0011-15-C-0098
+ * HR0011-20-C-0160
+ *
+ * Any opinions, findings and conclusions or recommendations expressed in
+ * this material are those of the author(s) and do not necessarily reflect
+ * the views, either expressed or implied, of the U.S. Government.
+ *
+ * DoD Distribution Statement A
+ * Approved for Public Release, Distribution Unlimited
+ *
+ * DISTAR Case 37651, cleared February 13, 2023.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#ifndef _PD3_ESTIMATOR_WORKERPOOL_H_
+#define _PD3_ESTIMATOR_WORKERPOOL_H_
+
+/* Task run by every worker of a pool, with the pool's argument and
+ * the worker's index */
+typedef void (*workerpool_task)(void *arg, unsigned int worker);
+
+/* Pool of threads running the same task together, one round at a
+ * time. The thread calling workerpool_run() takes part as worker 0,
+ * so a pool of one worker starts no threads. */
+struct workerPool;
+
+/* Returns a pool of `nworkers` workers running `task`, or NULL on
+ * error. A pool whose threads cannot all be started runs with the
+ * workers that were. */
+struct workerPool *workerpool_create(unsigned int nworkers, workerpool_task task, void *arg);
+
+/* Runs one round of the task on every worker, and returns once all of
+ * them are done */
+void workerpool_run(struct workerPool *pool);
+
+/* Stops and joins the workers */
+void workerpool_destroy(struct workerPool *pool);
+
+#endif /* _PD3_ESTIMATOR_WORKERPOOL_H_ */